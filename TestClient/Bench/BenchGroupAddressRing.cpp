@@ -0,0 +1,91 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**************************************************
+Benchmark of GroupAddressRing (NetGroup addresses)
+Addresses are added by batches of 20 (one Group
+Report) followed by a read, then looked up and
+erased in a row as in the heard list cleanup.
+Build with "make bench" in TestClient and run ./BenchGroupAddressRing
+*/
+
+#include "GroupAddressRing.h"
+#include <cstdio>
+#include <random>
+#include <chrono>
+#include <vector>
+
+using namespace Mona;
+using namespace std;
+
+#define BENCH_REPORT_SIZE	20 // Number of addresses added by a Group Report
+
+static double Elapsed(chrono::steady_clock::time_point& start) {
+	chrono::steady_clock::time_point now(chrono::steady_clock::now());
+	double result = chrono::duration<double, milli>(now - start).count();
+	start = now;
+	return result;
+}
+
+int main(int argc, char* argv[]) {
+	mt19937_64 random(1);
+	const UInt32 sizes[] = { 1000, 10000, 100000 };
+	for (UInt32 count : sizes) {
+		vector<PeerId> peers(count);
+		vector<UInt8> addresses(count * GROUP_ADDRESS_SIZE);
+		for (UInt32 i = 0; i < count; ++i) {
+			UInt8 rawId[PEER_ID_SIZE];
+			for (UInt8& byte : rawId)
+				byte = (UInt8)random();
+			peers[i] = PeerId(rawId);
+			for (UInt32 j = 0; j < GROUP_ADDRESS_SIZE; ++j)
+				addresses[i * GROUP_ADDRESS_SIZE + j] = (UInt8)random();
+		}
+
+		GroupAddressRing ring;
+		chrono::steady_clock::time_point start(chrono::steady_clock::now());
+		for (UInt32 i = 0; i < count; ++i) {
+			ring.add(&addresses[i * GROUP_ADDRESS_SIZE], peers[i]);
+			if ((i % BENCH_REPORT_SIZE) == BENCH_REPORT_SIZE - 1)
+				ring.estimatedCount(&addresses[0]); // read after each Group Report
+		}
+		ring.estimatedCount(&addresses[0]);
+		double addTime = Elapsed(start);
+
+		UInt32 found(0);
+		for (UInt32 i = 0; i < count; ++i)
+			found += ring.peerId(ring.lowerBound(&addresses[i * GROUP_ADDRESS_SIZE])) == peers[i];
+		double lookupTime = Elapsed(start);
+
+		UInt32 erased(0);
+		for (UInt32 i = 0; i < count; i += 2)
+			erased += ring.erase(&addresses[i * GROUP_ADDRESS_SIZE]);
+		ring.estimatedCount(&addresses[GROUP_ADDRESS_SIZE]);
+		double eraseTime = Elapsed(start);
+
+		if (found != count || erased != (count + 1) / 2 || ring.size() != count - erased) {
+			printf("Error with %u addresses : %u found, %u erased, size %u\n", count, found, erased, ring.size());
+			return 1;
+		}
+		printf("%u addresses : add %.1fms (batches of %u), lookup %.1fms, erase half %.1fms\n", count, addTime, BENCH_REPORT_SIZE, lookupTime, eraseTime);
+	}
+	return 0;
+}
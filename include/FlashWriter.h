@@ -53,6 +53,10 @@ public:
 	void					open() { if(_state==OPENING) _state = OPENED;}
 
 	virtual bool			flush() { return false;  } // return true if something has been sent!
+
+	// Stage of the last message sent and of the last message acknowledged (0 if not supported)
+	virtual Mona::UInt64	stage() { return 0; }
+	virtual Mona::UInt64	stageAck() { return 0; }
 	
 	bool					amf0;
 	
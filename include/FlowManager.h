@@ -24,11 +24,15 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "Publisher.h"
 #include "FlashConnection.h"
 #include "RTMFPConnection.h"
+#include "MediaRing.h"
+#include "librtmfp.h"
 
 // Callback typedef definitions
 typedef void(*OnStatusEvent)(const char*, const char*);
 typedef void(*OnMediaEvent)(const char *, const char*, unsigned int, const char*, unsigned int, int);
 typedef void(*OnSocketError)(const char*);
+typedef void(*OnMediaBatchEvent)(const RTMFPMediaFrame*, unsigned int);
+typedef void(*OnStreamOpenEvent)(unsigned int, const char*, const char*);
 
 class Invoker;
 class RTMFPFlow;
@@ -41,10 +45,13 @@ It is the base class of RTMFPSession and P2PSession
 */
 class FlowManager : public virtual Mona::Object {
 public:
-	FlowManager(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent);
+	FlowManager(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, OnMediaBatchEvent pOnMediaBatch, OnStreamOpenEvent pOnStreamOpen);
 
 	~FlowManager();
 
+	// Deliver the batch of synchronous media frames (pOnMediaBatch)
+	virtual void				flushMedia();
+
 	enum CommandType {
 		NETSTREAM_PLAY = 1,
 		NETSTREAM_PUBLISH,
@@ -80,7 +87,25 @@ public:
 	// Read data asynchronously
 	// peerId : id of the peer if it is a p2p connection, otherwise parameter is ignored
 	// return : false if the connection is not established
-	bool							readAsync(Mona::UInt8* buf, Mona::UInt32 size, int& nbRead);
+	bool							readAsync(Mona::UInt8* buf, Mona::UInt32 size, int& nbRead) { return readAsync(_readQueue, buf, size, nbRead); }
+
+	// Borrow the next FLV tag of the asynchronous read buffer without copying it
+	// return : false if the connection is not established, tag is set to NULL if nothing is available
+	bool							readPacket(const Mona::UInt8*& tag, Mona::UInt32& size) { return readPacket(_readQueue, tag, size); }
+
+	// Release the FLV tag borrowed with readPacket()
+	void							releasePacket() { releasePacket(_readQueue); }
+
+	// Return true if one of the asynchronous read queues of the session is not empty
+	virtual bool					dataWaiting() { return !_readQueue.empty(); }
+
+	// Set the maximum duration of media in the asynchronous read queue (0 for unlimited)
+	void							setMaxReadDuration(Mona::UInt32 duration) { _maxReadDuration = duration; }
+
+	Mona::UInt32					maxReadDuration() const { return _maxReadDuration; }
+
+	// Return the duration of media (audio and video) dropped to stay under the maximum read duration (in msec)
+	virtual Mona::UInt64			droppedDuration() { return _droppedDuration; }
 
 	// Latency (ping / 2)
 	Mona::UInt16					latency();
@@ -90,12 +115,51 @@ public:
 
 protected:
 
+	// Media reception state and asynchronous read ring of a stream
+	struct ReadQueue {
+		ReadQueue() : ready(false), skipTo(0), dropping(false), dropTime(0), firstRead(true), firstMedia(true), timeStart(0), codecInfosRead(false) {}
+
+		// Return the read ring if it has been created, otherwise NULL (reader side)
+		MediaRing*					ring() { return ready.load(std::memory_order_acquire) ? pRing.get() : NULL; }
+
+		// Return true if nothing can be read (reader side)
+		bool						empty() { MediaRing* pRing = ring(); return !pRing || pRing->empty(); }
+
+		// Drop the tags preceding the key frame requested by the producer (reader side)
+		void						skip(MediaRing& ring) { Mona::UInt64 position = skipTo.load(std::memory_order_acquire); if (position && ring.skip(position)) skipTo = 0; }
+
+		std::unique_ptr<MediaRing>	pRing; // SPSC ring of FLV tags (created on first media)
+		std::atomic<bool>			ready; // True when pRing can be read
+		std::atomic<Mona::UInt64>	skipTo; // Position of the key frame from which the reader must restart, 0 if none
+		bool						dropping; // True while media is dropped, until the next key frame
+		Mona::UInt32				dropTime; // Time of the first media packet dropped
+		bool						firstRead; // True until the FLV header has been read
+		bool						firstMedia;
+		Mona::UInt32				timeStart;
+		bool						codecInfosRead; // Player : False until the video codec infos have been read
+	};
+
 	// Analyze packets received from the server (must be connected)
 	void						receive(Mona::BinaryReader& reader);
 
+	// Deliver a media packet splitted in count spans of a total of size bytes to the application
+	// The spans are gathered only once : in the read ring, the batch buffer or the synchronous read buffer
+	void						handleMedia(const std::string& stream, Mona::UInt32 time, const MediaSpan* spans, Mona::UInt32 count, Mona::UInt32 size, double lostRate, bool audio) { handleMedia(_readQueue, stream, time, spans, count, size, lostRate, audio); }
+
+	// Deliver a media packet through the read queue in parameter
+	void						handleMedia(ReadQueue& queue, const std::string& stream, Mona::UInt32 time, const MediaSpan* spans, Mona::UInt32 count, Mona::UInt32 size, double lostRate, bool audio);
+
+	// Read functions of a specific read queue (see readAsync(), readPacket() and releasePacket())
+	bool						readAsync(ReadQueue& queue, Mona::UInt8* buf, Mona::UInt32 size, int& nbRead);
+	bool						readPacket(ReadQueue& queue, const Mona::UInt8*& tag, Mona::UInt32& size);
+	void						releasePacket(ReadQueue& queue);
+
 	// Handle data available or not event (asynchronous read only)
 	virtual void				handleDataAvailable(bool isAvailable) = 0;
 
+	// Handle a status event (to wake up the polling application)
+	virtual void				handleStatusEvent() = 0;
+
 	// Handle play request (only for P2PSession)
 	virtual bool				handlePlay(const std::string& streamName, Mona::UInt16 streamId, Mona::UInt64 flowId, double cbHandler) { return false; }
 
@@ -138,6 +202,8 @@ protected:
 	// External Callbacks to link with parent
 	OnStatusEvent										_pOnStatusEvent;
 	OnMediaEvent										_pOnMedia;
+	OnMediaBatchEvent									_pOnMediaBatch;
+	OnStreamOpenEvent									_pOnStreamOpen;
 	OnSocketError										_pOnSocketError;
 
 	// Events
@@ -159,6 +225,8 @@ protected:
 
 	FlashListener*										_pListener; // Listener of the main publication (only one by intance)
 
+	ReadQueue											_readQueue; // Read queue of the session (all streams except the additional NetGroup streams)
+
 private:
 
 	// Unsubscribe from all events of the connection
@@ -167,24 +235,29 @@ private:
 	// Remove a flow from the list of flows
 	void												removeFlow(RTMFPFlow* pFlow);
 
+	// Update the data available status after a read
+	void												updateDataAvailable(MediaRing* pRing);
+
 	std::map<Mona::SocketAddress, std::shared_ptr<RTMFPConnection>>				_mapConnections; // map of connections to all addresses of the session
 	Mona::Time																	_closeTime; // Time since closure
 
 	// Asynchronous read
-	struct RTMFPMediaPacket : public Mona::Object {
-
-		RTMFPMediaPacket(const Mona::PoolBuffers& poolBuffers, const Mona::UInt8* data, Mona::UInt32 size, Mona::UInt32 time, bool audio);
-
-		Mona::PoolBuffer	pBuffer;
-		Mona::UInt32		pos;
-	};
-	std::map<std::string, std::deque<std::shared_ptr<RTMFPMediaPacket>>>		_mediaPackets;
-	std::recursive_mutex														_readMutex;
-	bool																		_firstRead;
+	std::mutex																	_mediaWriteMutex; // Serialize the producers (receive & manage threads), never taken by the reader
+	std::atomic<Mona::UInt32>													_maxReadDuration; // Maximum duration of media waiting in the ring (in msec), 0 for unlimited
+	std::atomic<Mona::UInt64>													_droppedDuration; // Duration of media (audio and video) dropped or skipped because the reader was too late (all read queues)
 	static const char															_FlvHeader[];
 
+	// Synchronous batched read
+	std::vector<RTMFPMediaFrame>												_mediaBatch; // Frames waiting to be delivered
+	std::vector<RTMFPMediaFrame>												_mediaBatchFlushed; // Frames being delivered (without lock)
+	Mona::Buffer																_mediaBatchBuffers[2]; // Payloads of the frames waiting and of the frames being delivered
+	Mona::UInt8																	_mediaBatchIndex; // Index of the buffer of the frames waiting
+	std::mutex																	_mediaBatchMutex; // Protect the frames waiting, never held while calling the application
+	std::mutex																	_mediaFlushMutex; // Held by the thread delivering the frames
+	std::atomic<bool>															_mediaFlushRequested; // True if frames must be delivered by the thread holding _mediaFlushMutex
+	std::map<std::string, Mona::UInt32>											_mapStreamIds; // map of stream name to stream handle
+	static std::atomic<Mona::UInt32>											StreamCounter; // Global counter for generating stream handles
+
 	// Read
-	bool																		_firstMedia;
-	Mona::UInt32																_timeStart;
-	bool																		_codecInfosRead; // Player : False until the video codec infos have been read
+	Mona::Buffer																_mediaBuffer; // Synchronous read : buffer used to gather splitted packets
 };
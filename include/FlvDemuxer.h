@@ -0,0 +1,70 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "Mona/Buffer.h"
+#include <functional>
+
+/**************************************************
+FlvDemuxer is an incremental FLV parser, it accepts
+chunks of any size and keeps the incomplete tags
+internally until the next call (the caller never
+has to submit the same bytes twice).
+The FLV header is only expected at the beginning
+of the stream, raw tags are accepted otherwise.
+*/
+class FlvDemuxer : public virtual Mona::Object {
+public:
+	// Called for each complete tag (body is the payload of the tag)
+	// return : false to stop parsing (the tag will be delivered again on next call)
+	typedef std::function<bool(Mona::UInt8 type, Mona::UInt32 time, const Mona::UInt8* body, Mona::UInt32 size)> OnTag;
+
+	FlvDemuxer();
+
+	// Parse a chunk of FLV data
+	// return : the number of bytes consumed (size unless onTag returned false)
+	Mona::UInt32		parse(const Mona::UInt8* data, Mona::UInt32 size, const OnTag& onTag);
+
+	// Reset the parser to the beginning of a stream
+	void				reset();
+
+	// Return the number of bytes kept from a previous chunk
+	Mona::UInt32		pending() const { return _carry.size(); }
+
+private:
+	#define FLV_HEADER_SIZE		13 // FLV signature + flags + header size + first PreviousTagSize
+	#define FLV_TAG_HEADER_SIZE	11 // type + size (24bits) + time (24bits + 8bits) + stream id (24bits)
+
+	// Return the size of the tag (header + body + footer) starting at tag
+	static Mona::UInt32	TagSize(const Mona::UInt8* tag) { return FLV_TAG_HEADER_SIZE + ((tag[1] << 16) | (tag[2] << 8) | tag[3]) + 4; }
+
+	// Deliver the complete tag to onTag (invalid tags are ignored)
+	bool				deliver(const Mona::UInt8* tag, Mona::UInt32 size, const OnTag& onTag);
+
+	// Copy up to size bytes from data to reach needed bytes in the carry buffer
+	// return : the number of bytes copied
+	Mona::UInt32		fill(const Mona::UInt8* data, Mona::UInt32 size, Mona::UInt32 needed);
+
+	bool				_header; // True while the FLV header is expected
+	Mona::Buffer		_carry; // Incomplete header or tag waiting for further data
+};
@@ -0,0 +1,207 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include <vector>
+#include <memory>
+#include <new>
+
+#define FRAGMENT_RING_SIZE		0x400 // Default capacity of a fragment ring (number of fragments)
+#define FRAGMENT_RING_MAX_SIZE	0x100000 // Maximum capacity of a fragment ring, oldest fragments are evicted beyond
+#define FRAGMENT_RING_CHUNK		0x40 // Number of fragments allocated at once in the pool of the ring
+
+/**************************************************
+FragmentRing is a store of group fragments indexed
+by their id. Fragment ids are dense and monotonic so
+they are stored in a power of 2 ring (id & mask) with
+a presence bitmap, the ring grows if the window of ids
+exceeds its capacity.
+Fragments are constructed in place in a pool of
+chunks which are reused (no allocation per fragment)
+and never move, so T does not need to be movable.
+*/
+template<typename T>
+class FragmentRing : public virtual Mona::Object {
+public:
+	FragmentRing(Mona::UInt32 capacity = FRAGMENT_RING_SIZE) : _first(0), _last(0), _count(0) { resize(capacity); }
+	virtual ~FragmentRing() { clear(); }
+
+	bool				empty() const { return !_count; }
+	Mona::UInt32		size() const { return _count; }
+
+	// Id of the first and last fragments (undefined if empty)
+	Mona::UInt64		firstId() const { return _first; }
+	Mona::UInt64		lastId() const { return _last; }
+	T&					first() { return *_slots[_first & _mask]; }
+	T&					last() { return *_slots[_last & _mask]; }
+
+	bool				has(Mona::UInt64 id) const { return _count && id >= _first && id <= _last && (_bits[(id & _mask) >> 6] & (1ULL << (id & 63))); }
+
+	// Return the presence of the 64 fragments ending at id : bit n is set if the fragment id - n is present
+	// Ids must be in the window of the ring (id - 63 >= lastId() - capacity + 1)
+	Mona::UInt64		presence(Mona::UInt64 id) const {
+		Mona::UInt64 pos((id - 63) & _mask), word(_bits[pos >> 6] >> (pos & 63));
+		if (pos & 63)
+			word |= _bits[((pos >> 6) + 1) & (_bits.size() - 1)] << (64 - (pos & 63));
+		// reverse the bits (bit 63 is the fragment id)
+		word = ((word >> 1) & 0x5555555555555555ULL) | ((word & 0x5555555555555555ULL) << 1);
+		word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+		word = ((word >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((word & 0x0F0F0F0F0F0F0F0FULL) << 4);
+		word = ((word >> 8) & 0x00FF00FF00FF00FFULL) | ((word & 0x00FF00FF00FF00FFULL) << 8);
+		word = ((word >> 16) & 0x0000FFFF0000FFFFULL) | ((word & 0x0000FFFF0000FFFFULL) << 16);
+		return (word >> 32) | (word << 32);
+	}
+
+	// Return the presence of the 64 fragments word containing id : bit n is set if the fragment (id & ~63) + n is present
+	Mona::UInt64		word(Mona::UInt64 id) const {
+		if (!_count || (id | 63) < _first || (id & ~63ULL) > _last)
+			return 0;
+		Mona::UInt64 word(_bits[(id & _mask) >> 6]);
+		if ((id & ~63ULL) < _first)
+			word &= ~0ULL << (_first & 63);
+		if ((id | 63) > _last)
+			word &= ~0ULL >> (63 - (_last & 63));
+		return word;
+	}
+
+	// Return the fragment or NULL if not present
+	T*					find(Mona::UInt64 id) { return has(id) ? _slots[id & _mask] : NULL; }
+
+	// Add a fragment, the oldest fragments are evicted if the window is too large
+	// return : the fragment or NULL if it is already present or too old
+	template <typename ...Args>
+	T*					emplace(Mona::UInt64 id, Args&&... args) {
+		if (has(id))
+			return NULL;
+		if (_count) {
+			Mona::UInt64 first = id < _first ? id : _first, last = id > _last ? id : _last;
+			if (last - first >= _slots.size()) {
+				if (last - first < FRAGMENT_RING_MAX_SIZE)
+					resize((Mona::UInt32)(last - first + 1));
+				else if (id < _first)
+					return NULL; // too old
+				else {
+					eraseBefore(id - FRAGMENT_RING_MAX_SIZE + 1);
+					if (_count && id - _first >= _slots.size())
+						resize((Mona::UInt32)(id - _first + 1)); // the remaining window must not alias
+				}
+			}
+		}
+		T* pFragment = new (allocate()) T(std::forward<Args>(args)...);
+		if (!_count)
+			_first = _last = id;
+		else if (id < _first)
+			_first = id;
+		else if (id > _last)
+			_last = id;
+		++_count;
+		_bits[(id & _mask) >> 6] |= (1ULL << (id & 63));
+		return _slots[id & _mask] = pFragment;
+	}
+
+	// Remove a fragment
+	void				erase(Mona::UInt64 id) {
+		if (!has(id))
+			return;
+		remove(id);
+		if (!_count)
+			return;
+		if (id == _first)
+			while (!has(++_first));
+		else if (id == _last)
+			while (!has(--_last));
+	}
+
+	// Remove all the fragments < id
+	void				eraseBefore(Mona::UInt64 id) {
+		if (!_count)
+			return;
+		if (id > _last) {
+			clear();
+			return;
+		}
+		for (; _first < id; ++_first) {
+			if (has(_first))
+				remove(_first);
+		}
+		while (!has(_first))
+			++_first;
+	}
+
+	void				clear() {
+		for (; _count && _first <= _last; ++_first) {
+			if (has(_first))
+				remove(_first);
+		}
+		_count = 0;
+	}
+
+private:
+	void				remove(Mona::UInt64 id) {
+		_bits[(id & _mask) >> 6] &= ~(1ULL << (id & 63));
+		T* pFragment = _slots[id & _mask];
+		pFragment->~T();
+		_free.emplace_back(pFragment);
+		--_count;
+	}
+
+	// Return the memory of a new fragment from the pool
+	void*				allocate() {
+		if (_free.empty()) {
+			_chunks.emplace_back(new Mona::UInt8[sizeof(T) * FRAGMENT_RING_CHUNK]); // aligned for any type, and sizeof(T) is a multiple of alignof(T)
+			for (Mona::UInt32 i = FRAGMENT_RING_CHUNK; i > 0; --i)
+				_free.emplace_back(_chunks.back().get() + (i - 1) * sizeof(T));
+		}
+		void* pMemory = _free.back();
+		_free.pop_back();
+		return pMemory;
+	}
+
+	// Set the capacity (rounded up to a power of 2, 64 minimum) and move the fragments
+	void				resize(Mona::UInt32 capacity) {
+		Mona::UInt32 size(64);
+		while (size < capacity)
+			size <<= 1;
+		std::vector<T*> slots(size);
+		std::vector<Mona::UInt64> bits(size >> 6);
+		Mona::UInt64 mask(size - 1);
+		for (Mona::UInt64 id = _first; _count && id <= _last; ++id) {
+			if (!has(id))
+				continue;
+			slots[id & mask] = _slots[id & _mask];
+			bits[(id & mask) >> 6] |= (1ULL << (id & 63));
+		}
+		_slots = std::move(slots);
+		_bits = std::move(bits);
+		_mask = mask;
+	}
+
+	std::vector<T*>						_slots; // Fragments indexed by id & _mask (valid only if the presence bit is set)
+	std::vector<Mona::UInt64>			_bits; // Presence bitmap
+	std::vector<std::unique_ptr<Mona::UInt8[]>>	_chunks; // Memory pool of the fragments (kept until the ring is deleted)
+	std::vector<void*>					_free; // Free fragment memory in the pool
+	Mona::UInt64						_mask;
+	Mona::UInt64						_first; // Id of the first fragment
+	Mona::UInt64						_last; // Id of the last fragment
+	Mona::UInt32						_count; // Number of fragments
+};
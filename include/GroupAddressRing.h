@@ -0,0 +1,90 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "PeerId.h"
+#include <vector>
+
+#define GROUP_ADDRESS_SIZE		0x20 // Size of a group address (SHA-256 of the raw peer id)
+
+/**************************************************
+GroupAddressRing is the ring of the group addresses
+known in a NetGroup, sorted in a contiguous array of
+binary addresses. Navigation around the ring is done
+with indexes and the distances are computed on the
+64 first bits of the addresses.
+New and erased addresses are applied at the next read
+to merge the peers of a Group Report in one pass.
+*/
+class GroupAddressRing : public virtual Mona::Object {
+public:
+	GroupAddressRing();
+
+	// Add a group address, peerId must stay valid until the address is erased
+	void					add(const Mona::UInt8* address, const PeerId& peerId);
+
+	// Erase a group address
+	// return : false if the address is not found
+	bool					erase(const Mona::UInt8* address);
+
+	bool					empty() const { return !_count; }
+	Mona::UInt32			size() const { return _count; }
+
+	// Counter incremented each time an address is added or erased (never 0)
+	Mona::UInt32			version() const { return _version; }
+
+	// Return the index of the first address greater or equal to address (size() if there is none)
+	Mona::UInt32			lowerBound(const Mona::UInt8* address);
+
+	// Return the index + offset around the ring (offset can be negative)
+	Mona::UInt32			move(Mona::UInt32 index, int offset) const { return (Mona::UInt32)(((Mona::Int64)index + offset) % _count + _count) % _count; }
+
+	// Return the peer id of the address at index (must be < size())
+	const PeerId&			peerId(Mona::UInt32 index) { update(); return *_entries[index].pPeerId; }
+
+	// Estimation of the number of peers from the distance between the neighbors N-2 and N+2 of address
+	// (same as Flash NetGroup.estimatedMemberCount), cached until the ring or the address change
+	double					estimatedCount(const Mona::UInt8* address);
+
+	// Return the 64 first bits of the address (big endian)
+	static Mona::UInt64		Prefix(const Mona::UInt8* address);
+
+private:
+	struct Entry {
+		Mona::UInt8			address[GROUP_ADDRESS_SIZE];
+		const PeerId*		pPeerId; // NULL if erased
+	};
+	static bool				Less(const Entry& entry1, const Entry& entry2) { return memcmp(entry1.address, entry2.address, GROUP_ADDRESS_SIZE) < 0; }
+
+	// Sort the new addresses, merge them and remove the erased addresses
+	void					update();
+
+	std::vector<Entry>		_entries; // sorted addresses followed by the new ones
+	Mona::UInt32			_sorted; // number of sorted entries
+	Mona::UInt32			_count; // number of addresses (erased ones excluded)
+	bool					_erased; // true if an entry has been erased since the last update
+	Mona::UInt32			_version;
+
+	double					_estimatedCount; // cached estimation (0 if it must be computed)
+	Mona::UInt8				_estimatedAddress[GROUP_ADDRESS_SIZE]; // address of the cached estimation
+};
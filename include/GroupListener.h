@@ -37,7 +37,7 @@ public:
 	virtual void stopPublishing();
 
 	virtual void pushAudio(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
-	virtual void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
+	virtual void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame);
 
 	virtual void flush();
 
@@ -45,7 +45,7 @@ private:
 
 	bool	firstTime() { return !_dataInitialized; }
 
-	bool	pushVideoInfos(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
+	bool	pushVideoInfos(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame);
 	bool	pushAudioInfos(Mona::UInt32 time);
 
 	Mona::UInt32 			_startTime;
@@ -24,9 +24,15 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "Mona/Mona.h"
 #include "P2PSession.h"
 #include "GroupListener.h"
+#include "FragmentRing.h"
+#include "PeerId.h"
+#include <deque>
+
+#define GROUPMEDIA_PULL_STATS_COUNT		100 // Number of pull requests between each log of the time-to-fill percentiles
+#define GROUPMEDIA_MAX_FRAGMENTS_GAP	0x10000 // Maximum distance between a fragment id received and the last one known, farther ids are rejected
 
 namespace GroupMediaEvents {
-	struct OnGroupPacket : Mona::Event<void(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, double lostRate, bool audio)> {}; // called when receiving a new packet
+	struct OnGroupPacket : Mona::Event<void(const std::string& stream, Mona::UInt32 time, const MediaSpan* spans, Mona::UInt32 count, Mona::UInt32 size, double lostRate, bool audio)> {}; // called when receiving a new packet (splitted packets are not gathered)
 }
 
 class MediaPacket;
@@ -60,15 +66,21 @@ public:
 	GroupEvents::OnMedia::Type					onMedia; // onMedia event when it is publisher
 	
 private:
-	#define MAP_PEERS_INFO_TYPE std::map<std::string, std::shared_ptr<PeerMedia>>
-	#define MAP_PEERS_INFO_ITERATOR_TYPE std::map<std::string, std::shared_ptr<PeerMedia>>::iterator
-	#define MAP_FRAGMENTS_ITERATOR std::map<Mona::UInt64, MediaPacket>::iterator
+	#define MAP_PEERS_INFO_TYPE std::map<PeerId, std::shared_ptr<PeerMedia>>
+	#define MAP_PEERS_INFO_ITERATOR_TYPE std::map<PeerId, std::shared_ptr<PeerMedia>>::iterator
+
+	// Add a new fragment of the publication to the ring _fragments (publisher)
+	void						addFragment(Mona::UInt8 marker, Mona::UInt64 id, Mona::UInt8 splitedNumber, Mona::UInt8 mediaType, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
 
-	// Add a new fragment to the map _fragments
-	void						addFragment(MAP_FRAGMENTS_ITERATOR& itFragment, PeerMedia* pPeer, Mona::UInt8 marker, Mona::UInt64 id, Mona::UInt8 splitedNumber, Mona::UInt8 mediaType, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
+	// Add a fragment received from a peer to the ring _fragments
+	// message : the whole wire message (group marker included) positioned on the payload, it is stored as is
+	void						addFragment(PeerMedia* pPeer, Mona::UInt8 marker, Mona::UInt64 id, Mona::UInt8 splitedNumber, Mona::UInt8 mediaType, Mona::UInt32 time, Mona::PacketReader& message);
 
-	// Push an arriving fragment to the peers and write it into the output file (recursive function)
-	bool						pushFragment(std::map<Mona::UInt64, MediaPacket>::iterator& itFragment);
+	// Send a new fragment to the peers (push mode, except to pPeer) and reference its time
+	void						pushToPeers(PeerMedia* pPeer, Mona::UInt64 id, MediaPacket& fragment);
+
+	// Deliver the fragments to the application in order, starting from idFragment and until a hole is found
+	void						pushFragment(Mona::UInt64 idFragment);
 
 	// Update the fragment map
 	// Return 0 if there is no fragments, otherwise the last fragment number
@@ -77,7 +89,7 @@ private:
 	// Erase old fragments (called before generating the fragments map)
 	void						eraseOldFragments();
 
-	// Calculate the push play mode balance and send the requests if needed
+	// Assign each push mask to the fastest pusher, remove the duplicate pushers and test a new pusher
 	void						sendPushRequests();
 
 	// Send the Pull requests if needed
@@ -88,8 +100,23 @@ private:
 	// ascending : order of the research
 	bool						getNextPeer(MAP_PEERS_INFO_ITERATOR_TYPE& itPeer, bool ascending, Mona::UInt64 idFragment, Mona::UInt8 mask);
 
-	// Send the fragment pull request to the next available peer
-	bool						sendPullToNextPeer(Mona::UInt64 idFragment);
+	// Send the fragment pull request to the available peer with the best pull score (see PeerMedia::pullScore)
+	bool						sendPullToBestPeer(Mona::UInt64 idFragment);
+
+	// Record a pull request sent to the peer, the requests too old to stay in the ring are cancelled before
+	void						addPullRequest(Mona::UInt64 idFragment, MAP_PEERS_INFO_ITERATOR_TYPE itPeer);
+
+	// Cancel the pull requests of the fragments < idFragment
+	void						cancelPullRequests(Mona::UInt64 idFragment);
+
+	// Return true if the fragment id is too far from the last fragment known (wrong or malicious peer)
+	bool						isFragmentTooFar(Mona::UInt64 idFragment);
+
+	// Return the timeout of a pull request to the peer (3 x RTT, between NETGROUP_PULL_TIMEOUT_MIN and the fetch period)
+	Mona::UInt32				pullTimeout(PeerMedia& peer);
+
+	// Record the time to fill a pulled fragment and log the percentiles regularly
+	void						addPullTime(Mona::UInt32 time);
 
 	// Remove the peer from the map
 	void						removePeer(const std::string& peerId);
@@ -105,9 +132,10 @@ private:
 	Mona::Time													_lastPullUpdate; // last Play Pull calculation
 	Mona::Time													_lastFragmentsMap; // last Fragments Map Message calculation
 
-	std::map<Mona::UInt64, MediaPacket>							_fragments;
-	std::map<Mona::UInt32, Mona::UInt64>						_mapTime2Fragment; // Map of time to fragment (only START and DATA fragments are referenced)
+	FragmentRing<MediaPacket>									_fragments; // Fragments indexed by id
+	std::deque<std::pair<Mona::UInt32, Mona::UInt64>>			_mapTime2Fragment; // Ordered list of time to fragment (only START and DATA fragments are referenced, fragments received late are not)
 	Mona::UInt64												_fragmentCounter; // Current fragment counter of writed fragments (fragments sent to application)
+	std::vector<MediaSpan>										_spans; // Payloads of the splitted packet being delivered (reused)
 
 	static Mona::Buffer											_fragmentsMapBuffer; // General buffer for fragments map
 	static Mona::UInt32											GroupMediaCounter; // static counter of GroupMedia for id assignment
@@ -125,19 +153,23 @@ private:
 
 	// Pushers calculation
 	bool														_firstPushMode; // True if no play push mode have been send for now
-	Mona::UInt8													_currentPushMask; // current mask analyzed
-	std::map<Mona::UInt8, std::pair<std::string, Mona::UInt64>>	_mapPushMasks; // Map of push mask to a pair of peerId/fragmentId
+	Mona::UInt8													_currentPushMask; // current mask tested with a new pusher
+	Mona::UInt64												_pushInCount; // Number of fragments received in push mode
+	Mona::UInt64												_pushInDuplicates; // Number of fragments received in push mode which were already received
 
-	 // Pull calculation TODO: convert PullRequest to a pair<peerId, time>
+	 // Pull calculation
 	struct PullRequest : public Object {
-		PullRequest(std::string id) : peerId(id) {}
+		PullRequest(const PeerId& id, Mona::UInt32 timeout) : peerId(id), timeout(timeout) {}
 
-		std::string peerId; // Id of the peer to which we have send the pull request
+		PeerId peerId; // Id of the peer to which we have send the pull request
 		Mona::Time time; // Time when the request have been done
+		Mona::Time start; // Time of the first request
+		Mona::UInt32 timeout; // Delay before sending the request to another peer (in msec)
 	};
-	std::map<Mona::UInt64, PullRequest>							_mapWaitingFragments; // Map of waiting fragments in Pull requests to peer Id
+	FragmentRing<PullRequest>									_waitingFragments; // Ring of waiting fragments in Pull requests (indexed by fragment id)
 	std::map<Mona::Int64, Mona::UInt64>							_mapPullTime2Fragment; // Map of reception time to fragments map id (used for pull requests)
 	Mona::UInt64												_lastFragmentMapId; // Last Fragments map Id received (used for pull requests)
 	Mona::UInt64												_currentPullFragment; // Current pull fragment index
 	bool														_firstPullReceived; // True if we have received the first pull fragment => we can start writing
+	std::vector<Mona::UInt32>									_pullTimes; // Last times to fill a pulled fragment (in msec)
 };
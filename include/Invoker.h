@@ -33,10 +33,14 @@ class ConnectionsManager : private Mona::Task, public Mona::Startable, public vi
 public:
 	ConnectionsManager(Invoker& invoker);
 	virtual ~ConnectionsManager() {}
+
+	// Wake up the manager before the end of its delay (to flush the asynchronous publications)
+	void requestFlush() { wakeUp(); }
 private:
 	void run(Mona::Exception& ex);
 	void handle(Mona::Exception& ex);
-	Invoker& _invoker;
+	Invoker&		_invoker;
+	Mona::Time		_lastManage; // Time of the last call to Invoker::manage()
 };
 
 class RTMFPLogger;
@@ -60,6 +64,9 @@ public:
 
 	void			terminate();
 
+	// Ask the Invoker thread to send the asynchronous publications as soon as possible
+	void			requestFlushPublications();
+
 	/*** Log functions ***/
 	void			setLogCallback(void(*onLog)(unsigned int, int, const char*, long, const char*));
 
@@ -70,12 +77,14 @@ public:
 	const Mona::PoolBuffers					poolBuffers;
 private:
 	virtual void		manage();
+	void				flushPublications();
 	void				requestHandle() { wakeUp(); }
 	void				run(Mona::Exception& exc);
 
 	bool											_init; // True if at least a connection has been added
 	ConnectionsManager								_manager;
 	int												_lastIndex; // last index of connection
+	std::atomic<bool>								_flushRequested; // True if an asynchronous publication is waiting
 
 	std::recursive_mutex							_mutexConnections;
 	std::map<int, std::shared_ptr<RTMFPSession>>	_mapConnections;
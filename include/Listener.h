@@ -21,6 +21,13 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 #include "FlashWriter.h"
+#include <deque>
+#include <atomic>
+
+#define FLASHLISTENER_DROP_DELAY	500 // Delay (in msec) of unacknowledged video from which the non-reference frames are dropped (unreliable video only)
+#define FLASHLISTENER_DROP_GOP_DELAY	1000 // Delay (in msec) of unacknowledged video from which the video is dropped until the next key frame
+
+namespace Mona { class PoolThread; }
 
 class Publisher;
 class Listener : public virtual Mona::Object {
@@ -32,14 +39,19 @@ public:
 	virtual void stopPublishing() = 0;
 
 	virtual void pushAudio(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size) = 0;
-	virtual void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size) = 0;
+	virtual void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame) = 0;
 	//virtual void pushData(DataReader& packet) = 0;
 	//virtual void pushProperties(DataReader& packet) = 0;
 
 	virtual void flush() = 0;
 
+	// Return true if the listener only writes on its own connection (it can be pushed by a worker thread)
+	virtual bool threadable() const { return false; }
+
 	const Publisher&	publication;
 	const std::string&	identifier;
+	Mona::PoolThread*	pThread; // Worker thread of the listener (multi-threaded fan-out only)
+	std::atomic<bool>	replaying; // True until the GOP cache has been sent by the Invoker thread (live frames are not pushed)
 
 protected:
 	Mona::PacketReader& publicationNamePacket() { _publicationNamePacket.reset(); return _publicationNamePacket; }
@@ -58,12 +70,17 @@ public:
 	virtual void stopPublishing();
 
 	virtual void pushAudio(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
-	virtual void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
+	virtual void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame);
 	//virtual void pushData(DataReader& packet);
 	//virtual void pushProperties(DataReader& packet);
 
 	virtual void flush();
 
+	virtual bool threadable() const { return true; }
+
+	// Number of video frames dropped because the peer was late
+	Mona::UInt32	droppedFrames() const { return _droppedFrames; }
+
 	bool receiveAudio;
 	bool receiveVideo;
 
@@ -79,6 +96,12 @@ private:
 
 	bool	pushAudioInfos(Mona::UInt32 time);
 
+	// Return the delay (in msec) between time and the oldest video frame not acknowledged by the peer
+	Mona::UInt32	videoDelay(Mona::UInt32 time);
+
+	// Return true if the video frame must be dropped to catch up with the peer (unreliable video only)
+	bool	dropVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame);
+
 	Mona::UInt32 			_startTime;
 	Mona::UInt32			_lastTime;
 	bool					_firstTime;
@@ -90,4 +113,9 @@ private:
 	FlashWriter*			_pVideoWriter;
 	bool					_dataInitialized;
 	bool					_reliable;
+	bool					_videoReliable;
+
+	std::deque<std::pair<Mona::UInt32, Mona::UInt64>>	_videoSent; // Time and writer stage of the video frames sent and not acknowledged
+	bool					_waitKeyFrame; // True if the video is dropped until the next key frame
+	Mona::UInt32			_droppedFrames;
 };
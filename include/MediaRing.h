@@ -0,0 +1,111 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "Mona/Buffer.h"
+#include <atomic>
+
+struct MediaSpan;
+
+#define MEDIA_RING_SIZE		0x400000 // Default size of the asynchronous read ring (4MB)
+
+/**************************************************
+MediaRing is a preallocated single-producer/single-consumer
+ring of FLV tags used for asynchronous read.
+Tags are written in place by the network thread and read
+by the RTMFP_Read thread without lock nor allocation.
+Each tag is stored contiguously after a 4 bytes record
+header, a padding record is written when a tag does not
+fit before the end of the ring.
+*/
+class MediaRing : public virtual Mona::Object {
+public:
+	// capacity : size of the ring in bytes, rounded up to a power of 2
+	MediaRing(Mona::UInt32 capacity = MEDIA_RING_SIZE);
+
+	/*** Producer side ***/
+
+	// Write an FLV tag (header + payload + footer) into the ring
+	// flags : internal flags saved in the last byte of the stream id field (always 0 for FLV readers)
+	// return : false if there is not enough space, the tag is then ignored
+	bool					writeTag(Mona::UInt8 type, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, Mona::UInt8 flags=0);
+
+	// Write an FLV tag whose payload is splitted in count spans of a total of size bytes (gathered directly into the ring)
+	bool					writeTag(Mona::UInt8 type, Mona::UInt32 time, const MediaSpan* spans, Mona::UInt32 count, Mona::UInt32 size, Mona::UInt8 flags=0);
+
+	// Return the position of the next tag written (see skip())
+	Mona::UInt64			position() const { return _head.load(std::memory_order_relaxed); }
+
+	/*** Consumer side ***/
+
+	// Read up to size bytes of FLV tags, a tag can be read in many times
+	// return : the number of bytes read
+	Mona::UInt32			read(Mona::UInt8* buf, Mona::UInt32 size);
+
+	// Borrow the next complete FLV tag without copying it
+	// return : a pointer to the tag (valid until release()) or NULL if the ring is empty
+	const Mona::UInt8*		peek(Mona::UInt32& size);
+
+	// Release the tag returned by peek()
+	void					release();
+
+	// Drop the tags written before position (returned by position())
+	// return : false if the current tag is partially read, nothing is dropped
+	bool					skip(Mona::UInt64 position);
+
+	// Return true if there is nothing to read
+	bool					empty() const { return _tail.load(std::memory_order_relaxed) == _head.load(std::memory_order_acquire); }
+
+	// Number of bytes currently buffered (approximation from any thread)
+	Mona::UInt32			bytesQueued() const { return (Mona::UInt32)(_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire)); }
+
+	// Duration of the tags currently buffered (difference between the last tag written and the last tag read, in msec)
+	Mona::UInt32			duration() const;
+
+	// Number of tags ignored because the ring was full
+	Mona::UInt64			overflows() const { return _overflows.load(std::memory_order_relaxed); }
+
+private:
+	#define MEDIA_RING_PADDING	0xFFFFFFFF // Record size of a padding record (end of the ring)
+
+	// Return the next record of the ring (skipping padding) or NULL if empty
+	// record : position of the record, size : size of the FLV tag
+	const Mona::UInt8*		next(Mona::UInt64& record, Mona::UInt32& size);
+
+	// Return the size in the ring of a record containing size bytes (aligned on 4 bytes)
+	static Mona::UInt32		RecordSize(Mona::UInt32 size) { return (4 + size + 3) & ~3; }
+
+	// Release the record and save the time of its tag
+	void					consume(Mona::UInt64 record, const Mona::UInt8* tag, Mona::UInt32 size);
+
+	Mona::Buffer			_buffer; // preallocated memory
+	Mona::UInt64			_mask; // capacity - 1
+
+	std::atomic<Mona::UInt64>	_head; // write position (only modified by the producer)
+	std::atomic<Mona::UInt64>	_tail; // read position (only modified by the consumer)
+	std::atomic<Mona::UInt64>	_overflows;
+	std::atomic<Mona::UInt32>	_headTime; // time of the last tag written
+	std::atomic<Mona::UInt32>	_tailTime; // time of the last tag read
+
+	Mona::UInt32			_readPos; // Position in the current record (consumer only)
+};
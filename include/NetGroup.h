@@ -26,7 +26,10 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "RTMFPSession.h"
 #include "GroupListener.h"
 #include "GroupMedia.h"
+#include "GroupAddressRing.h"
 #include <set>
+#include <unordered_map>
+#include <mutex>
 
 #define NETGROUP_MAX_PACKET_SIZE		959
 #define MAX_PEER_COUNT					0xFFFFFFFFFFFFFFFF
@@ -34,6 +37,9 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #define NETGROUP_REPORT_DELAY			10000	// delay between each NetGroup Report (in msec)
 #define NETGROUP_PUSH_DELAY				2000	// delay between each push request (in msec)
 #define NETGROUP_PULL_DELAY				100		// delay between each pull request (in msec)
+#define NETGROUP_MAX_PEER_PULLS			32		// maximum number of pull requests waiting for fragments per peer
+#define NETGROUP_PULL_WINDOW			128		// maximum number of pull requests waiting for fragments
+#define NETGROUP_PULL_TIMEOUT_MIN		250		// minimum timeout of a pull request (in msec), it is 3 x RTT of the peer otherwise
 #define NETGROUP_PEER_TIMEOUT			300000	// number of seconds since the last report known before we delete a peer from the heard list
 #define NETGROUP_DISCONNECT_DELAY		90000	// delay between each try to disconnect from a peer
 
@@ -83,21 +89,26 @@ public:
 
 	// Stop listening if we are publisher
 	void			stopListener();
+
+	// Register an additional stream to play from the NetGroup (using the same peers)
+	// The media already offered by the peers for this stream are accepted at the next manage()
+	// return : false if the stream is already registered
+	bool			addStream(const std::string& streamName);
 	
 	const std::string					idHex;	// Group ID in hex format
 	const std::string					idTxt;	// Group ID in plain text (without final zeroes)
-	const std::string					stream;	// Stream name
+	const std::string					stream;	// Main stream name (played or published)
 	RTMFPGroupConfig*					groupParameters; // NetGroup parameters
 
 private:
-	#define MAP_PEERS_TYPE std::map<std::string, std::shared_ptr<P2PSession>>
-	#define MAP_PEERS_ITERATOR_TYPE std::map<std::string, std::shared_ptr<P2PSession>>::iterator
+	#define MAP_PEERS_TYPE std::map<PeerId, std::shared_ptr<P2PSession>>
+	#define MAP_PEERS_ITERATOR_TYPE std::map<PeerId, std::shared_ptr<P2PSession>>::iterator
 
 	// Static function to read group config parameters sent in a Media Subscription message
 	static void					ReadGroupConfig(std::shared_ptr<RTMFPGroupConfig>& parameters, Mona::PacketReader& packet);
 
-	// Return the Group Address calculated from a Peer ID
-	static const std::string&	GetGroupAddressFromPeerId(const char* rawId, std::string& groupAddress);
+	// Calculate the Group Address (binary, GROUP_ADDRESS_SIZE bytes) from a raw Peer ID
+	static void					GetGroupAddressFromPeerId(const char* rawId, Mona::UInt8* groupAddress);
 
 	// Calculate the estimation of the number of peers (this is the same as Flash NetGroup.estimatedMemberCount)
 	double						estimatedPeersCount();
@@ -111,11 +122,14 @@ private:
 	// Return false if the peer is not found
 	void						sendGroupReport(P2PSession* pPeer, bool initiator);
 
-	// Update our NetGroup Best List
+	// Update our NetGroup Best List and connect to its peers
 	void						updateBestList();
 
+	// Return our Best List, calculated again only if the heard list or the connected peers have changed
+	const std::set<PeerId>&		bestList();
+
 	// Calculate the Best list from a group address
-	void						buildBestList(const std::string& groupAddress, std::set<std::string>& bestList);
+	void						buildBestList(const Mona::UInt8* groupAddress, std::set<PeerId>& bestList);
 
 	// Connect and disconnect peers to fit the best list
 	void						manageBestConnections();
@@ -123,6 +137,12 @@ private:
 	// Read the group report and return true if at least a new peer has been found
 	bool						readGroupReport(Mona::PacketReader& packet);
 
+	// Add the peer to the GroupMedia of the stream key (created if it does not exist) and send the Media Subscription
+	void						addPeerMedia(const std::string& peerId, std::shared_ptr<PeerMedia>& pPeerMedia, const std::string& stream, const std::string& streamKey, std::shared_ptr<RTMFPGroupConfig>& pParameters);
+
+	// Accept the media offered for the streams registered since the subscription of the peers
+	void						acceptPendingMedias();
+
 	P2PEvents::OnPeerGroupBegin::Type						onGroupBegin;
 	P2PEvents::OnPeerGroupReport::Type						onGroupReport;
 	P2PEvents::OnNewMedia::Type								onNewMedia;
@@ -130,11 +150,24 @@ private:
 	P2PEvents::OnPeerGroupAskClose::Type					onGroupAskClose;
 	GroupMediaEvents::OnGroupPacket::Type					onGroupPacket;
 
-	std::string												_myGroupAddress; // Our Group Address (peer identifier into the NetGroup)
+	const PeerId											_myPeerId; // Our Peer ID (binary)
+	Mona::UInt8												_myGroupAddress[GROUP_ADDRESS_SIZE]; // Our Group Address (peer identifier into the NetGroup)
 
-	std::map<std::string, GroupNode>						_mapHeardList; // Map of peer ID to Group address
-	std::map<std::string,std::string>						_mapGroupAddress; // Map of Group Address to peer ID (same as heard list)
-	std::set<std::string>									_bestList; // Last best list calculated
+	std::map<PeerId, GroupNode>								_mapHeardList; // Map of peer ID to Group address
+	GroupAddressRing										_groupAddresses; // Sorted Group Addresses of the heard list
+	std::set<PeerId>										_bestList; // Last best list calculated
+	Mona::UInt32											_bestListVersion; // Version of the group addresses ring when _bestList has been calculated
+	bool													_bestListObsolete; // True if _bestList must be calculated again (peers or latencies changed)
+
+	// Best List calculated for the Group Report of a connected peer
+	struct TargetBestList {
+		TargetBestList() : version(0) {}
+
+		std::set<PeerId>		peers;
+		Mona::UInt32			version; // version of the group addresses ring
+		Mona::Time				time; // time of the calculation
+	};
+	std::unordered_map<PeerId, TargetBestList, PeerId::Hash>	_mapTargetBestLists; // Map of peer ID to the Best List of its Group Reports
 	MAP_PEERS_TYPE											_mapPeers; // Map of peers ID to p2p connections
 	GroupListener*											_pListener; // Listener of the main publication (only one by intance)
 	RTMFPSession&											_conn; // RTMFPSession related to
@@ -142,6 +175,19 @@ private:
 	Mona::Time												_lastReport; // last Report Message calculation
 	Mona::Buffer											_reportBuffer; // Buffer for reporting messages
 
+	std::set<std::string>									_streams; // Names of the streams registered (the main stream and the additional streams played)
+	std::mutex												_mutexStreams; // Protect _streams (streams are added by the application thread)
+	// Media offered by a peer for a stream not registered (yet)
+	struct PendingMedia {
+		PendingMedia(const std::string& peerId, const std::shared_ptr<PeerMedia>& pPeerMedia, const std::string& streamKey, const std::shared_ptr<RTMFPGroupConfig>& pParameters) :
+			peerId(peerId), pPeerMedia(pPeerMedia), streamKey(streamKey), pParameters(pParameters) {}
+
+		std::string							peerId;
+		std::weak_ptr<PeerMedia>			pPeerMedia;
+		std::string							streamKey;
+		std::shared_ptr<RTMFPGroupConfig>	pParameters;
+	};
+	std::map<std::string, std::vector<PendingMedia>>		_pendingMedias; // map of stream name to the media offered (network thread only)
 	std::map<std::string, GroupMedia>						_mapGroupMedias; // map of stream key to GroupMedia
 	std::map<std::string, GroupMedia>::iterator				_groupMediaPublisher; // iterator to the GroupMedia publisher
 };
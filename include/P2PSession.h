@@ -49,7 +49,7 @@ class P2PSession : public FlowManager,
 	public P2PEvents::OnPeerClose,
 	public P2PEvents::OnPeerGroupAskClose {
 public:
-	P2PSession(RTMFPSession* parent, std::string id, Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, /*const PEER_LIST_ADDRESS_TYPE& addresses,*/
+	P2PSession(RTMFPSession* parent, std::string id, Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, OnMediaBatchEvent pOnMediaBatch, OnStreamOpenEvent pOnStreamOpen, /*const PEER_LIST_ADDRESS_TYPE& addresses,*/
 		const Mona::SocketAddress& host, bool responder, bool group);
 
 	virtual ~P2PSession();
@@ -116,6 +116,9 @@ public:
 	// Manage the flows
 	virtual void				manage() { FlowManager::manage(); }
 
+	// Deliver the batch of synchronous media frames, and the NetGroup ones received through this session
+	virtual void				flushMedia();
+
 	/*** Public members ***/
 
 	std::string						rawId; // Peer Id in binary format + header (210f)
@@ -142,6 +145,9 @@ protected:
 	// Handle data available or not event (asynchronous read only)
 	virtual void					handleDataAvailable(bool isAvailable);
 
+	// Handle a status event (to wake up the polling application)
+	virtual void					handleStatusEvent();
+
 private:
 
 	// Handle a NetGroup connection message from a peer connected (only for P2PSession)
@@ -0,0 +1,68 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "Mona/Util.h"
+#include "RTMFP.h"
+
+/**************************************************
+PeerId is a Peer ID in binary format (PEER_ID_SIZE
+bytes, without the 210f header) used as key in the
+NetGroup containers. Comparison is done on the raw
+bytes so the order is the same as the hex format,
+which is only computed for logs and API calls.
+*/
+class PeerId {
+public:
+	PeerId() { memset(_id, 0, PEER_ID_SIZE); }
+	explicit PeerId(const Mona::UInt8* rawId) { memcpy(_id, rawId, PEER_ID_SIZE); }
+	// Build from the hex format, the peer id is empty if the format is not valid
+	explicit PeerId(const std::string& peerId) {
+		memset(_id, 0, PEER_ID_SIZE);
+		if (peerId.size() != PEER_ID_SIZE * 2)
+			return;
+		std::string tmp(peerId);
+		if (Mona::Util::UnformatHex(tmp).size() == PEER_ID_SIZE)
+			memcpy(_id, tmp.data(), PEER_ID_SIZE);
+	}
+
+	bool					operator==(const PeerId& other) const { return memcmp(_id, other._id, PEER_ID_SIZE) == 0; }
+	bool					operator!=(const PeerId& other) const { return !operator==(other); }
+	bool					operator<(const PeerId& other) const { return memcmp(_id, other._id, PEER_ID_SIZE) < 0; }
+
+	const Mona::UInt8*		data() const { return _id; }
+
+	bool					empty() const { static const Mona::UInt8 Zero[PEER_ID_SIZE] = {}; return memcmp(_id, Zero, PEER_ID_SIZE) == 0; }
+	void					clear() { memset(_id, 0, PEER_ID_SIZE); }
+
+	// Return the peer id in hex format
+	std::string				toString() const { std::string result; return Mona::Util::FormatHex(_id, PEER_ID_SIZE, result); }
+
+	// Hash functor for unordered containers, the id is a SHA-256 so its first bytes are already well distributed
+	struct Hash {
+		std::size_t operator()(const PeerId& peerId) const { std::size_t value; memcpy(&value, peerId._id, sizeof(value)); return value; }
+	};
+
+private:
+	Mona::UInt8				_id[PEER_ID_SIZE];
+};
@@ -24,7 +24,7 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "Mona/Mona.h"
 #include "Mona/Event.h"
 #include "Mona/PacketReader.h"
-#include <set>
+#include <vector>
 
 #define MAX_FRAGMENT_MAP_SIZE			1024 // TODO: check this
 
@@ -78,6 +78,10 @@ public:
 	// Return True if the fragment is available
 	bool hasFragment(Mona::UInt64 index);
 
+	// Return the fragments available for pull in the 64 fragments word containing index
+	// bit n is set if the fragment (index & ~63) + n is available and not blacklisted
+	Mona::UInt64 fragmentsAvailable(Mona::UInt64 index);
+
 	// Write the Group publication infos
 	void sendGroupMedia(const std::string& stream, const std::string& streamKey, RTMFPGroupConfig* groupConfig);
 
@@ -99,6 +103,34 @@ public:
 	// Send a pull request (2B)
 	void sendPull(Mona::UInt64 index);
 
+	enum PullResult {
+		PULL_RECEIVED, // fragment received from this peer
+		PULL_TIMEOUT, // fragment not received in time
+		PULL_CANCELLED // fragment received from another peer or deleted
+	};
+
+	// Called when a pull request sent to this peer is done (update the pull statistics)
+	void endPull(PullResult result);
+
+	// Record a fragment pushed by the peer for the mask bit number
+	// delay : delay since the first copy of the fragment has been received (0 if it is the first one, in msec)
+	void addPushDelay(Mona::UInt8 bitNumber, Mona::UInt32 delay);
+
+	// Average delay of the fragments pushed for the mask bit number compared to the first copies (in msec)
+	double pushDelay(Mona::UInt8 bitNumber) { return _pushDelays[bitNumber]; }
+
+	// Number of fragments pushed for the mask bit number since the last call to resetPushCounts()
+	Mona::UInt32 pushCount(Mona::UInt8 bitNumber) { return _pushCounts[bitNumber]; }
+
+	void resetPushCounts() { memset(_pushCounts, 0, sizeof(_pushCounts)); }
+
+	// Return the latency of the peer (half of the RTT in msec)
+	Mona::UInt16 latency();
+
+	// Return the score of the peer for the next pull request (lower is better)
+	// It is the latency weighted by the number of waiting requests and by the reliability of the last requests
+	double pullScore();
+
 	// Handle a pull request
 	void onPlayPull(Mona::UInt64 index);
 
@@ -109,6 +141,7 @@ public:
 	Mona::UInt64					idFlowMedia; // id of the Media RTMFPFlow (the one who send fragments)
 	const std::string*				pStreamKey; // pointer to the streamKey index in the map P2PSession::_mapStream2PeerMedia
 	Mona::UInt8						pushInMode; // Group Play Push mode
+	Mona::UInt32					pullsInFlight; // Number of pull requests waiting for a fragment
 	bool							groupMediaSent; // True if the Group Media infos have been sent
 private:
 	// Return true if the new fragment is pushable (according to the Group push mode)
@@ -117,10 +150,15 @@ private:
 	P2PSession*						_pParent; // P2P session related to
 
 	Mona::UInt8						_pushOutMode; // Group Publish Push mode
-	Mona::Buffer					_fragmentsMap; // Last Fragments Map received
+	// Bitsets of fragments aligned on 64 fragments words : bit n of word i is the fragment (_fragmentsBase + i) * 64 + n
+	std::vector<Mona::UInt64>		_fragments; // Fragments available (from the last Fragments Map received)
+	std::vector<Mona::UInt64>		_blacklistPull; // Fragments blacklisted for pull requests to this peer (bounded to the fragments map window)
+	Mona::UInt64					_fragmentsBase; // Index of the first word of the bitsets
 	Mona::UInt64					_idFragmentsMapIn; // Last ID received from the Fragments Map
 	Mona::UInt64					_idFragmentsMapOut; // Last ID sent in the Fragments map
-	std::set<Mona::UInt64>			_blacklistPull; // set of fragments blacklisted for pull requests to this peer
+	double							_pullReliability; // Moving average of the pull requests success (1 : all received)
+	double							_pushDelays[8]; // Moving average of the push delay for each mask bit
+	Mona::UInt32					_pushCounts[8]; // Number of fragments pushed for each mask bit
 	std::shared_ptr<RTMFPWriter>	_pMediaReportWriter; // Media Report writer used to send report messages from the current media
 	std::shared_ptr<RTMFPWriter>	_pMediaWriter; // Writer for media packets
 };
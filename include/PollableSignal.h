@@ -0,0 +1,70 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+/**************************************************
+PollableSignal is a level-triggered readiness signal
+that can be waited by the library (wait/WaitAny) or
+polled by the application through a file descriptor
+(eventfd on Linux, pipe on other POSIX systems).
+The descriptor is readable while the signal is set.
+*/
+class PollableSignal : public virtual Mona::Object {
+public:
+	PollableSignal();
+	virtual ~PollableSignal();
+
+	// Set the signal (make the descriptor readable)
+	void			set();
+
+	// Reset the signal (drain the descriptor)
+	void			reset();
+
+	// Return true if the signal is set
+	bool			isSet() const { return _set.load(std::memory_order_acquire); }
+
+	// Return the file descriptor to poll, or -1 if not supported (Windows)
+	int				fd() const { return _fds[0]; }
+
+	// Wait for the signal to be set
+	// return : true if the signal is set, false if the timeout is elapsed
+	bool			wait(Mona::UInt32 millisec);
+
+	// Wait for at least one signal to be set
+	// return : the number of signals set, 0 if the timeout is elapsed
+	static Mona::UInt32 WaitAny(const std::vector<PollableSignal*>& signals, Mona::UInt32 millisec);
+
+private:
+	std::atomic<bool>					_set;
+	std::mutex							_mutex; // protect the state of the descriptor
+	int									_fds[2]; // read and write descriptors (the same for eventfd)
+
+	static std::mutex					Mutex; // mutex for waiting threads (wait/WaitAny only)
+	static std::condition_variable		Condition; // notified each time a signal is set while a thread is waiting
+	static std::atomic<Mona::UInt32>	Waiters; // number of threads in wait/WaitAny
+};
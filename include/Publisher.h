@@ -26,19 +26,42 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 //#include "Mona/QualityOfService.h"
 #include "DataReader.h"
 #include "Mona/Task.h"
+#include "MediaRing.h"
+#include "FlvDemuxer.h"
 #include <deque>
+#include <condition_variable>
+
+// Media frame flags (RTMFP_WriteFrame)
+#define PUBLISHER_FRAME_KEY		0x01 // Key frame (video only)
+#define PUBLISHER_FRAME_CONFIG	0x02 // Codec configuration (AAC/H264 sequence header)
+#define PUBLISHER_FRAME_FLAGS	0x80 // Flags are set by the caller, the payload is not analyzed
 
 class Invoker;
 class Listener;
 class Publisher : public Mona::Task, public virtual Mona::Object {
+	friend class ListenerRunner;
 public:
 
-	Publisher(const std::string& name, Invoker& invoker, bool audioReliable, bool videoReliable, bool p2p);
+	// asynchronous : if true the FLV tags are copied in a queue and sent by the Invoker thread (publish() never blocks)
+	Publisher(const std::string& name, Invoker& invoker, bool audioReliable, bool videoReliable, bool p2p, bool asynchronous=false);
 	virtual ~Publisher();
 
 	// Add packets to the waiting queue
 	bool publish(const Mona::UInt8* data, Mona::UInt32 size, int& pos);
 
+	// Add a media frame without FLV encapsulation (type is AMF::AUDIO or AMF::VIDEO)
+	// return : false if the frame has not been pushed (asynchronous queue full)
+	bool publishFrame(AMF::ContentType type, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, Mona::UInt8 flags);
+
+	// Send the FLV tags waiting in the queue (asynchronous mode, called by the Invoker thread)
+	void					flushQueue();
+
+	// Return the number of bytes waiting in the queue (asynchronous mode)
+	Mona::UInt32			queued() const { return _pQueue ? _pQueue->bytesQueued() : 0; }
+
+	// Return true if the last call to publish() has been stopped because the queue is full
+	bool					queueFull() const { return _queueFull; }
+
 	const std::string&		name() const { return _name; }
 
 	void					start();
@@ -56,22 +79,70 @@ public:
 		if (it != _listeners.begin())
 			--it;
 		ListenerType* pListener = new ListenerType(*this, identifier, args...);
+		if (_running)
+			requestReplay(*pListener); // start the new listener as soon as possible
 		_listeners.emplace_hint(it, identifier, pListener);
 		return pListener;
 	}
 	void					removeListener(const std::string& identifier);
 
+	bool						audioReliable() const { return _audioReliable; }
+	bool						videoReliable() const { return _videoReliable; }
+
 	const Mona::PoolBuffer&		audioCodecBuffer() const { return _audioCodecBuffer; }
 	const Mona::PoolBuffer&		videoCodecBuffer() const { return _videoCodecBuffer; }
 
+	// Push media to the threadable listeners on the worker threads of the Invoker (one thread per listener)
+	void					setMultiThreaded(bool multiThreaded) { _multiThreaded = multiThreaded; }
+
+	// Set the maximum size of the GOP cache (0 to disable it)
+	void					setGopCacheSize(Mona::UInt32 size) { _gopCacheMax = size; if (!size) clearGop(); }
+
 	bool	isP2P; // If true it is a p2p publisher
 private:
 
-	void pushAudio(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
-	void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size);
+	// Save the frame in the GOP cache (a key frame starts a new GOP)
+	void cacheFrame(AMF::ContentType type, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame);
+
+	// Send the GOP cache to a new listener
+	void replayGop(Listener& listener);
+
+	// Ask the Invoker thread to send the GOP cache to a new listener before the next frames
+	void requestReplay(Listener& listener);
+
+	// Send the GOP cache to the listeners added since the last call (Invoker thread)
+	void replayPending();
+
+	void clearGop() { _gopCache.clear(); _gopCacheSize = 0; }
+
+	enum ListenerAction {
+		LISTENER_AUDIO,
+		LISTENER_VIDEO,
+		LISTENER_FLUSH
+	};
+
+	// Execute the action on the listener, on its worker thread if it is threadable
+	// pFrame : copy of the frame shared by all the listeners (created on first use)
+	void dispatch(Listener& listener, ListenerAction action, Mona::UInt32 time = 0, const Mona::UInt8* data = NULL, Mona::UInt32 size = 0, bool keyFrame = false,
+		std::shared_ptr<Mona::Buffer>* pFrame = NULL);
+
+	// Wait for all the actions of the worker threads to be done
+	void waitListeners();
+
+	// Called by a worker thread when an action is done
+	void endListenerTask();
+
+	// Push a media frame to the listeners, if PUBLISHER_FRAME_FLAGS is not set the flags are read from the payload
+	void pushMedia(Mona::UInt8 type, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, Mona::UInt8 flags);
+
+	void pushAudio(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool config);
+	void pushVideo(Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame, bool config);
 	/*void pushData(DataReader& packet);
 	void pushProperties(DataReader& packet);*/
 
+	// Copy the complete FLV tags in the queue (asynchronous mode)
+	bool publishQueued(const Mona::UInt8* data, Mona::UInt32 size, int& pos);
+
 	// Task handle : running function to send packets
 	virtual void handle(Mona::Exception& ex);
 
@@ -100,6 +171,41 @@ private:
 
 	bool									_new; // True if there is at list a packet to send
 
-	std::unique_ptr<Mona::PacketReader>		_reader; // Current reader of input data
-	int										_pos; // Current position of input data
+	FlvDemuxer								_demuxer; // Incremental FLV parser of input data
+	const Mona::UInt8*						_data; // Current input data (synchronous mode)
+	Mona::UInt32							_size; // Size of the current input data
+	Mona::UInt32							_consumed; // Number of bytes consumed by the demuxer
+
+	struct CachedFrame {
+		CachedFrame(AMF::ContentType type, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame) : type(type), time(time), keyFrame(keyFrame), pBuffer(new Mona::Buffer(size)) {
+			memcpy(pBuffer->data(), data, size);
+		}
+		AMF::ContentType						type;
+		Mona::UInt32							time;
+		bool									keyFrame;
+		std::shared_ptr<const Mona::Buffer>		pBuffer;
+	};
+	bool									_multiThreaded; // True if threadable listeners are pushed by the worker threads
+	Mona::UInt32							_listenerTasks; // Number of actions waiting in the worker threads
+	std::mutex								_listenerTasksMutex;
+	std::condition_variable					_listenerTasksCondition;
+	std::vector<std::shared_ptr<Mona::Buffer>>	_frames; // Copies of the frames pushed to the worker threads since the last flush
+
+	std::deque<CachedFrame>					_gopCache; // Frames since the last key frame (GOP cache)
+	Mona::UInt32							_gopCacheSize; // Size of the GOP cache in bytes
+	Mona::UInt32							_gopCacheMax; // Maximum size of the GOP cache, 0 if disabled
+	std::vector<std::string>				_replays; // Identifiers of the listeners waiting for the GOP cache
+	std::mutex								_replaysMutex;
+
+	struct Frame {
+		Frame() : type(AMF::EMPTY), time(0), data(NULL), size(0), flags(0) {}
+		AMF::ContentType		type;
+		Mona::UInt32			time;
+		const Mona::UInt8*		data;
+		Mona::UInt32			size;
+		Mona::UInt8				flags;
+	}										_frame; // Current frame of input data (publishFrame)
+
+	std::unique_ptr<MediaRing>				_pQueue; // Queue of FLV tags (asynchronous mode only)
+	std::atomic<bool>						_queueFull; // True if the queue was full at last publish() call
 };
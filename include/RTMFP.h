@@ -81,6 +81,14 @@ private:
 	EVP_CIPHER_CTX			_context;
 };
 
+// Part of a media packet, a packet can be delivered in many spans to avoid gathering it (splitted group fragments)
+struct MediaSpan {
+	MediaSpan(const Mona::UInt8* data = NULL, Mona::UInt32 size = 0) : data(data), size(size) {}
+
+	const Mona::UInt8*		data;
+	Mona::UInt32			size;
+};
+
 class RTMFP : virtual Mona::Static {
 public:
 	enum AddressType {
@@ -124,6 +132,9 @@ public:
 
 	static bool						IsH264CodecInfos(const Mona::UInt8* data, Mona::UInt32 size) { return size>1 && *data == 0x17 && data[1] == 0; }
 
+	// Return true if the video frame is not used as a reference by other frames (disposable inter frame or H264 NAL units with nal_ref_idc = 0)
+	static bool						IsDisposableFrame(const Mona::UInt8* data, Mona::UInt32 size);
+
 	// Read addresses from the buffer reader
 	// return : True if at least an address has been read
 	static bool	ReadAddresses(Mona::BinaryReader& reader, PEER_LIST_ADDRESS_TYPE& addresses, Mona::SocketAddress& hostAddress);
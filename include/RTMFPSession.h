@@ -24,7 +24,9 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "P2PSession.h"
 #include "Mona/HostEntry.h"
 #include "SocketHandler.h"
+#include "PollableSignal.h"
 #include <list>
+#include <set>
 
 /**************************************************
 RTMFPSession represents a connection to the
@@ -33,7 +35,7 @@ RTMFP Server
 class NetGroup;
 class RTMFPSession : public FlowManager {
 public:
-	RTMFPSession(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent);
+	RTMFPSession(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, OnMediaBatchEvent pOnMediaBatch, OnStreamOpenEvent pOnStreamOpen);
 
 	~RTMFPSession();
 
@@ -50,16 +52,33 @@ public:
 	void connect2Peer(const std::string& peerId, const char* streamName, const PEER_LIST_ADDRESS_TYPE& addresses, const Mona::SocketAddress& hostAddress);
 
 	// Connect to the NetGroup with netGroup ID (in the form G:...)
+	// If we are already connected to this NetGroup the stream is added to the streams played (with its own read queue)
 	void connect2Group(const char* streamName, RTMFPGroupConfig* parameters);
 
 	// Asynchronous read (buffered)
+	// peerId : id of a peer, name of an additional NetGroup stream, or anything else for the main read queue
 	// return : False if the connection is not established, true otherwise
 	bool read(const char* peerId, Mona::UInt8* buf, Mona::UInt32 size, int& nbRead);
 
+	// Asynchronous read without copy : borrow the next FLV tag (see read() for peerId)
+	// return : False if the connection is not established, true otherwise (tag is NULL if nothing is available)
+	bool readPacket(const char* peerId, const Mona::UInt8*& tag, Mona::UInt32& size);
+
+	// Release the FLV tag borrowed with readPacket()
+	void releasePacket();
+
+	// Return the duration of media (audio and video) dropped by the session and its P2P sessions to stay under the maximum read duration
+	virtual Mona::UInt64 droppedDuration();
+
 	// Write media (netstream must be published)
 	// return false if the client is not ready to publish, otherwise true
 	bool write(const Mona::UInt8* buf, Mona::UInt32 size, int& pos);
 
+	// Write a media frame without FLV encapsulation (netstream must be published)
+	// pushed : true if the frame has been accepted
+	// return false if the connection has failed, otherwise true
+	bool writeFrame(AMF::ContentType type, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, Mona::UInt8 flags, bool& pushed);
+
 	// Call a function of a server, peer or NetGroup
 	// param peerId If set to 0 the call we be done to the server, if set to "all" to all the peers of a NetGroup, and to a peer otherwise
 	// return 1 if the call succeed, 0 otherwise
@@ -83,20 +102,17 @@ public:
 		return _pPublisher->addListener<ListenerType, Args...>(ex, peerId, args...);
 	}
 
-	// Push the media packet to write into a file
-	void pushMedia(const std::string& stream, Mona::UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, double lostRate, bool audio) { 
-		Mona::PacketReader reader(data, size);
-		onMedia(stream, time, reader, lostRate, audio); 
-	}
+	// Push the media packet (splitted in count spans) of a NetGroup stream to the application
+	void pushMedia(const std::string& stream, Mona::UInt32 time, const MediaSpan* spans, Mona::UInt32 count, Mona::UInt32 size, double lostRate, bool audio);
 
 	// Remove the listener with peerId
 	void stopListening(const std::string& peerId);
 
 	// Set the p2p publisher as ready (used for blocking mode)
-	void setP2pPublisherReady() { p2pPublishSignal.set(); p2pPublishReady = true; }
+	void setP2pPublisherReady() { p2pPublishSignal.set(); p2pPublishReady = true; setStatusEvent(); }
 
 	// Set the p2p player as ready (used for blocking mode)
-	void setP2PPlayReady() { p2pPlaySignal.set(); p2pPlayReady = true; }
+	void setP2PPlayReady() { p2pPlaySignal.set(); p2pPlayReady = true; setStatusEvent(); }
 
 	// Called by P2PSession when we are connected to the peer
 	bool addPeer2Group(const std::string& peerId);
@@ -127,14 +143,44 @@ public:
 
 	bool							isPublisher() { return (bool)_pPublisher; }
 
+	// Send the FLV tags waiting in the asynchronous publication queue (called by the Invoker thread)
+	void							flushPublication() { if (_pPublisher) _pPublisher->flushQueue(); }
+
+	// Return the number of bytes waiting in the asynchronous publication queue
+	Mona::UInt32					publicationQueued() { return _pPublisher ? _pPublisher->queued() : 0; }
+
+	// Return true if the asynchronous publication queue was full at last write
+	bool							publicationFull() { return _pPublisher && _pPublisher->queueFull(); }
+
+	// Set the asynchronous publication mode (to call before publishing)
+	void							setAsyncPublish(bool asynchronous) { _asyncPublish = asynchronous; }
+
+	// Set the maximum size of the publisher's GOP cache (to call before publishing)
+	void							setGopCacheSize(Mona::UInt32 size) { _gopCacheSize = size; }
+
+	// Set the multi-threaded fan-out mode of the publisher (to call before publishing)
+	void							setParallelFanOut(bool parallel) { _parallelFanOut = parallel; }
+
 	void							setDataAvailable(bool isAvailable) { handleDataAvailable(isAvailable); }
 
+	// Return true if the main, NetGroup streams or p2p read queues are not empty
+	virtual bool					dataWaiting();
+
+	// Return true if the read queue of the p2p session, the NetGroup stream or the main stream named peerId is not empty
+	bool							dataWaiting(const char* peerId);
+
+	void							setStatusEvent() { handleStatusEvent(); }
+
+	// Return true if data or a status event is waiting, and acknowledge the status event (RTMFP_Poll)
+	bool							pollReady();
+
 	// Blocking members (used for ffmpeg to wait for an event before exiting the function)
 	Mona::Signal					connectSignal; // signal to wait connection
 	Mona::Signal					p2pPublishSignal; // signal to wait p2p publish
 	Mona::Signal					p2pPlaySignal; // signal to wait p2p publish
 	Mona::Signal					publishSignal; // signal to wait publication
 	Mona::Signal					readSignal; // signal to wait for asynchronous data
+	PollableSignal					readySignal; // set while asynchronous data or a status event is waiting (RTMFP_Poll)
 	bool							p2pPublishReady; // true if the p2p publisher is ready
 	bool							p2pPlayReady; // true if the p2p player is ready
 	bool							publishReady; // true if the publisher is ready
@@ -149,6 +195,9 @@ protected:
 	// Handle data available or not event
 	virtual void handleDataAvailable(bool isAvailable);
 
+	// Handle a status event (to wake up the polling application)
+	virtual void handleStatusEvent();
+
 	// Handle a Writer close message (type 5E)
 	virtual void handleWriterException(std::shared_ptr<RTMFPWriter>& pWriter);
 
@@ -181,6 +230,9 @@ private:
 	// Send handshake for group connection
 	void sendGroupConnection(const std::string& netGroup);
 
+	// Return the read queue of an additional NetGroup stream or NULL if the stream is not registered
+	ReadQueue* groupQueue(const std::string& stream);
+
 	static Mona::UInt32												RTMFPSessionCounter; // Global counter for generating incremental sessions id
 
 	std::unique_ptr<SocketHandler>									_pSocketHandler; // Socket handler object, manage the IO and contain all RTMFPConnection
@@ -191,6 +243,13 @@ private:
 	std::deque<std::string>											_waitingGroup; // queue of waiting connections to groups
 	std::mutex														_mutexConnections; // mutex for waiting connections (normal or p2p)
 	std::map<std::string, std::shared_ptr<P2PSession>>				_mapPeersById; // P2P connections by Id
+	bool															_asyncPublish; // True if RTMFP_Write must not block (FLV tags are queued)
+	Mona::UInt32													_gopCacheSize; // Maximum size of the publisher's GOP cache (0 to disable it)
+	bool															_parallelFanOut; // True if the publisher pushes media to its listeners on the worker threads
+	std::atomic<bool>												_statusPending; // true if a status event has not been acknowledged by RTMFP_Poll
+	std::shared_ptr<P2PSession>										_pPacketPeer; // Peer session owning the borrowed FLV tag (readPacket)
+	ReadQueue*														_pPacketQueue; // Read queue owning the borrowed FLV tag if it is not a peer session (readPacket)
+	bool															_packetBorrowed; // True if a FLV tag has been borrowed (readPacket)
 
 	std::string														_url; // RTMFP url of the application (base handshake)
 	std::string														_rawUrl; // Header (420A) + Url to be sent in handshake 30
@@ -202,6 +261,8 @@ private:
 	std::shared_ptr<RTMFPWriter>									_pMainWriter; // Main writer for the connection
 	std::shared_ptr<RTMFPWriter>									_pGroupWriter; // Writer for the group requests
 	std::shared_ptr<NetGroup>										_group;
+	std::map<std::string, std::unique_ptr<ReadQueue>>				_mapGroupQueues; // Read queues of the additional NetGroup streams (never erased before the session deletion)
+	std::mutex														_mutexGroupQueues; // Protect _mapGroupQueues (accessed by the application and the network threads)
 
 
 	FlashConnection::OnStreamCreated::Type							onStreamCreated; // Received when stream has been created and is waiting for a command
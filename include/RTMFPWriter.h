@@ -84,6 +84,7 @@ public:
 	bool				consumed() { return _messages.empty() && _state == CLOSED || (_state == NEAR_CLOSED && _closeTime.isElapsed(130000)); } // Wait 130s before closing the writer definetly
 
 	Mona::UInt64		stage() { return _stage; }
+	Mona::UInt64		stageAck() { return _stageAck; }
 
 	//bool				writeMedia(MediaType type,Mona::UInt32 time,Mona::PacketReader& packet,const Mona::Parameters& properties);
 	virtual void		writeRaw(const Mona::UInt8* data,Mona::UInt32 size);
@@ -19,6 +19,8 @@ You should have received a copy of the GNU Lesser General Public License
 along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#pragma once
+
 #if defined(_WIN32)
 	// Windows DLL declaration
 	#ifdef LIBRTMFP_EXPORT
@@ -30,6 +32,14 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 	#define LIBRTMFP_API
 #endif
 
+#define RTMFP_WOULD_BLOCK	-2 // Returned by RTMFP_Write when the asynchronous publication queue is full
+
+// Frame types and flags of RTMFP_WriteFrame
+#define RTMFP_FRAME_AUDIO	0x08 // Audio frame (FLV audio tag payload)
+#define RTMFP_FRAME_VIDEO	0x09 // Video frame (FLV video tag payload)
+#define RTMFP_FRAME_KEY		0x01 // Video key frame
+#define RTMFP_FRAME_CONFIG	0x02 // Codec configuration frame (AAC/H264 sequence header)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -46,13 +56,36 @@ LIBRTMFP_API typedef struct RTMFPGroupConfig {
 	unsigned short	pushLimit; // 4 by default, it is the number of neighbors (-1) to which we want to push fragments (cannot be changed)
 } RTMFPGroupConfig;
 
+LIBRTMFP_API typedef struct RTMFPMediaFrame {
+	unsigned int	streamId; // Handle of the stream (see pOnStreamOpen)
+	unsigned int	time; // Time of the frame (in msec)
+	int				audio; // 1 if it is an audio frame, 0 for video
+	const char*		data; // Frame payload (valid only during the callback)
+	unsigned int	size; // Size of the payload
+} RTMFPMediaFrame;
+
 LIBRTMFP_API typedef struct RTMFPConfig {
 	short	isBlocking; // False by default, if True the function will return only when we are connected
 	void	(*pOnSocketError)(const char*); // Socket Error callback
 	void	(*pOnStatusEvent)(const char*, const char*); // RTMFP Status Event callback
 	void	(*pOnMedia)(const char *, const char*, unsigned int, const char*, unsigned int, int); // In synchronous read mode this callback is called when receiving data
+	void	(*pOnMediaBatch)(const RTMFPMediaFrame*, unsigned int); // In synchronous read mode, if set it is called once per reception/manage cycle with all the frames received (instead of pOnMedia)
+	void	(*pOnStreamOpen)(unsigned int, const char*, const char*); // Called once before a new stream handle is used in pOnMediaBatch (stream id, peer id, stream name)
+	short	isAsyncPublish; // False by default, if True RTMFP_Write copies the FLV tags in a queue and never waits for them to be sent
+	unsigned int	gopCacheSize; // 0 by default (disabled), maximum size (in bytes) of the current GOP kept by the publisher to start new listeners without waiting for a key frame
+	short	isParallelFanOut; // False by default, if True the publisher pushes media to each direct listener on a worker thread (useful with many P2P listeners)
+	unsigned int	maxReadDuration; // 0 by default (unlimited), maximum duration (in msec) of media waiting for RTMFP_Read, audio and video are dropped until the next key frame when exceeded and the queued media is skipped to read it (audio is not continuous)
 } RTMFPConfig;
 
+LIBRTMFP_API typedef struct RTMFPPacket {
+	const char*		tag; // Complete FLV tag (11 bytes header + payload + 4 bytes footer)
+	unsigned int	tagSize; // Size of the FLV tag
+	const char*		data; // Payload of the tag (raw audio/video frame)
+	unsigned int	size; // Size of the payload
+	unsigned int	time; // Time of the frame (in msec)
+	int				audio; // 1 if it is an audio frame, 0 for video
+} RTMFPPacket;
+
 // This function MUST be called before any other
 // Initialize the RTMFP parameters with default values
 LIBRTMFP_API void RTMFP_Init(RTMFPConfig*, RTMFPGroupConfig*);
@@ -71,6 +104,9 @@ LIBRTMFP_API unsigned int RTMFP_Connect(const char* url, RTMFPConfig* parameters
 LIBRTMFP_API  int RTMFP_Connect2Peer(unsigned int RTMFPcontext, const char* peerId, const char* streamName, int blocking);
 
 // Connect to a NetGroup (in the G:... form)
+// If the connexion is already in this NetGroup the stream is played in addition to the others, with the same peers,
+// and read with RTMFP_Read/RTMFP_ReadPacket using the stream name as peerId (the stream name must not be the id of a connected peer)
+// The media already offered by the peers for this stream are accepted at the next management cycle
 LIBRTMFP_API int RTMFP_Connect2Group(unsigned int RTMFPcontext, const char* streamName, RTMFPGroupConfig* parameters);
 
 // RTMFP NetStream Play function
@@ -93,14 +129,50 @@ LIBRTMFP_API int RTMFP_ClosePublication(unsigned int RTMFPcontext, const char* s
 LIBRTMFP_API void RTMFP_Close(unsigned int RTMFPcontext);
 
 // Read size bytes of flv data from the current connexion (Asynchronous read, to be called by ffmpeg)
-// peerId : the id of the peer or an empty string
+// peerId : the id of the peer, the name of an additional NetGroup stream or an empty string
+// The P2P sessions are searched first, then the additional NetGroup streams, otherwise the main stream is read
 // return : the number of bytes read (always less or equal than size) or -1 if an error occurs
 LIBRTMFP_API int RTMFP_Read(const char* peerId, unsigned int RTMFPcontext, char *buf, unsigned int size);
 
+// Borrow the next FLV tag from the current connexion without copying it (Asynchronous read)
+// The FLV file header is not returned, the packet is valid until RTMFP_ReleasePacket is called (one packet at a time)
+// peerId : the id of the peer, the name of an additional NetGroup stream or an empty string (same lookup order as RTMFP_Read)
+// return : 1 if a packet has been read, 0 if interrupted or -1 if an error occurs
+LIBRTMFP_API int RTMFP_ReadPacket(const char* peerId, unsigned int RTMFPcontext, RTMFPPacket* packet);
+
+// Release the packet borrowed with RTMFP_ReadPacket
+LIBRTMFP_API void RTMFP_ReleasePacket(unsigned int RTMFPcontext);
+
+// Return the duration of media (audio and video) dropped or skipped (in msec) because the reader was later than maxReadDuration
+LIBRTMFP_API unsigned long long RTMFP_GetDroppedDuration(unsigned int RTMFPcontext);
+
+// Return a file descriptor readable while data or a status event is waiting on the connexion
+// It can be added to select/poll/epoll (level-triggered), it must not be read or closed by the caller
+// return : the file descriptor or -1 if not supported (Windows) or if an error occurs
+LIBRTMFP_API int RTMFP_GetReadyFd(unsigned int RTMFPcontext);
+
+// Wait until at least one of the connexions has data or a status event waiting
+// contexts : array of count connexions' contexts
+// ready : array of count integers set to 1 if the connexion is ready, 0 otherwise
+// timeout : maximum time to wait (in msec)
+// return : the number of connexions ready, 0 if timeout or interrupted, -1 if an error occurs
+LIBRTMFP_API int RTMFP_Poll(const unsigned int* contexts, unsigned int count, int* ready, unsigned int timeout);
+
 // Write size bytes of data into the current connexion
-// return the number of bytes used
+// Data can be cut anywhere, incomplete FLV tags are kept internally until the next call
+// return the number of bytes used (size unless the asynchronous queue is full), -1 if an error occurs or RTMFP_WOULD_BLOCK if the asynchronous queue is full (isAsyncPublish mode)
 LIBRTMFP_API int RTMFP_Write(unsigned int RTMFPcontext, const char *buf, int size);
 
+// Write a media frame into the current connexion (server, P2P or NetGroup publication) without FLV encapsulation
+// type : RTMFP_FRAME_AUDIO or RTMFP_FRAME_VIDEO
+// data : payload of the frame (as in the body of an FLV tag, codec header included), size must be greater than 0
+// flags : combination of RTMFP_FRAME_KEY and RTMFP_FRAME_CONFIG, the payload is not analyzed
+// return 1 if the frame has been sent (or queued), 0 if the stream is not published, -1 if an error occurs or RTMFP_WOULD_BLOCK if the asynchronous queue is full
+LIBRTMFP_API int RTMFP_WriteFrame(unsigned int RTMFPcontext, int type, unsigned int timestamp, const char* data, unsigned int size, int flags);
+
+// Return the number of bytes waiting to be sent in the asynchronous publication queue (isAsyncPublish mode)
+LIBRTMFP_API unsigned int RTMFP_GetPublishQueued(unsigned int RTMFPcontext);
+
 // Call a function of a server, peer or NetGroup
 // param peerId If set to 0 the call we be done to the server, if set to "all" to all the peers of a NetGroup, and to a peer otherwise
 // return 1 if the call succeed, 0 otherwise
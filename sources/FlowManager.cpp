@@ -32,34 +32,21 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 using namespace Mona;
 using namespace std;
 
-FlowManager::RTMFPMediaPacket::RTMFPMediaPacket(const PoolBuffers& poolBuffers, const UInt8* data, UInt32 size, UInt32 time, bool audio) : pBuffer(poolBuffers, size + 15), pos(0) {
-	BinaryWriter writer(pBuffer->data(), size + 15);
-
-	writer.write8(audio ? '\x08' : '\x09');
-	// size on 3 bytes
-	writer.write24(size);
-	// time on 3 bytes
-	writer.write24(time);
-	// unknown 4 bytes set to 0
-	writer.write32(0);
-	// payload
-	writer.write(data, size);
-	// footer
-	writer.write32(11 + size);
-
-}
-
 const char FlowManager::_FlvHeader[] = { 'F', 'L', 'V', 0x01,
 0x05,				/* 0x04 == audio, 0x01 == video */
 0x00, 0x00, 0x00, 0x09,
 0x00, 0x00, 0x00, 0x00
 };
 
-FlowManager::FlowManager(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent) :
-	_firstRead(true), _pInvoker(invoker), _firstMedia(true), _timeStart(0), _codecInfosRead(false), _pOnStatusEvent(pOnStatusEvent), _pOnMedia(pOnMediaEvent), _pOnSocketError(pOnSocketError),
+atomic<UInt32> FlowManager::StreamCounter(0);
+
+FlowManager::FlowManager(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, OnMediaBatchEvent pOnMediaBatch, OnStreamOpenEvent pOnStreamOpen) :
+	_maxReadDuration(0), _droppedDuration(0), _mediaBatchIndex(0), _mediaFlushRequested(false), _pInvoker(invoker), _pOnStatusEvent(pOnStatusEvent), _pOnMedia(pOnMediaEvent), _pOnSocketError(pOnSocketError),
+	_pOnMediaBatch(pOnMediaBatch), _pOnStreamOpen(pOnStreamOpen),
 	status(RTMFP::STOPPED), _tag(16, '0'), _sessionId(0), _pListener(NULL), _mainFlowId(0) {
 	onStatus = [this](const string& code, const string& description, UInt16 streamId, UInt64 flowId, double cbHandler) {
 		_pOnStatusEvent(code.c_str(), description.c_str());
+		handleStatusEvent();
 
 		if (code == "NetConnection.Connect.Success")
 			onConnect();
@@ -75,36 +62,8 @@ FlowManager::FlowManager(Invoker* invoker, OnSocketError pOnSocketError, OnStatu
 		return handlePlay(streamName, streamId, flowId, cbHandler);
 	};
 	onMedia = [this](const string& stream, UInt32 time, PacketReader& packet, double lostRate, bool audio) {
-
-		if (!_codecInfosRead) {
-			if (!audio && RTMFP::IsH264CodecInfos(packet.current(), packet.available())) {
-				INFO("Video codec infos found, starting to read")
-				_codecInfosRead = true;
-			} else {
-				if (!audio)
-					DEBUG("Video frame dropped to wait first key frame");
-				return;
-			}
-		}
-
-		if(_firstMedia) {
-			_firstMedia=false;
-			_timeStart=time; // to set to 0 the first packets
-		}
-		else if (time < _timeStart) {
-			DEBUG("Packet ignored because it is older (", time, ") than start time (", _timeStart, ")")
-			return;
-		}
-
-		if (_pOnMedia) // Synchronous read
-			_pOnMedia(name().c_str(), stream.c_str(), time-_timeStart, (const char*)packet.current(), packet.available(), audio);
-		else { // Asynchronous read
-			{
-				lock_guard<recursive_mutex> lock(_readMutex); // TODO: use the 'stream' parameter
-				_mediaPackets[name()].emplace_back(new RTMFPMediaPacket(_pInvoker->poolBuffers, packet.current(), packet.available(), time - _timeStart, audio));
-			}
-			handleDataAvailable(true);
-		}
+		MediaSpan span(packet.current(), packet.available());
+		handleMedia(stream, time, &span, 1, span.size, lostRate, audio);
 	};
 	/*TODO: onError = [this](const Exception& ex) {
 		string buffer;
@@ -142,8 +101,8 @@ FlowManager::~FlowManager() {
 	close(true);
 
 	// delete media packets
-	lock_guard<recursive_mutex> lock(_readMutex);
-	_mediaPackets.clear();
+	_readQueue.ready = false;
+	_readQueue.pRing.reset();
 
 	if (_pMainStream) {
 		_pMainStream->OnStatus::unsubscribe(onStatus);
@@ -152,6 +111,133 @@ FlowManager::~FlowManager() {
 	}
 }
 
+void FlowManager::handleMedia(ReadQueue& queue, const string& stream, UInt32 time, const MediaSpan* spans, UInt32 count, UInt32 size, double lostRate, bool audio) {
+
+	// Note : the FLV header bytes tested below are always in the first span (start fragment)
+
+	if (!queue.codecInfosRead) {
+		if (!audio && RTMFP::IsH264CodecInfos(spans->data, spans->size)) {
+			INFO("Video codec infos found, starting to read")
+			queue.codecInfosRead = true;
+		} else {
+			if (!audio)
+				DEBUG("Video frame dropped to wait first key frame");
+			return;
+		}
+	}
+
+	if(queue.firstMedia) {
+		queue.firstMedia=false;
+		queue.timeStart=time; // to set to 0 the first packets
+	}
+	else if (time < queue.timeStart) {
+		DEBUG("Packet ignored because it is older (", time, ") than start time (", queue.timeStart, ")")
+		return;
+	}
+	time -= queue.timeStart;
+
+	if (_pOnMediaBatch) { // Synchronous batched read
+		unique_lock<mutex> lock(_mediaBatchMutex);
+		auto itStream = _mapStreamIds.lower_bound(stream);
+		if (itStream == _mapStreamIds.end() || itStream->first != stream) {
+			itStream = _mapStreamIds.emplace_hint(itStream, stream, ++StreamCounter);
+			if (_pOnStreamOpen) {
+				UInt32 streamId = itStream->second;
+				lock.unlock(); // the application can call the library or block
+				_pOnStreamOpen(streamId, name().c_str(), stream.c_str());
+				lock.lock();
+			}
+		}
+		Buffer& buffer = _mediaBatchBuffers[_mediaBatchIndex];
+		UInt32 offset = buffer.size();
+		buffer.resize(offset + size, true);
+		for (UInt32 i = 0; i < count; offset += spans[i++].size)
+			memcpy(buffer.data() + offset, spans[i].data, spans[i].size);
+		_mediaBatch.push_back({ itStream->second, time, audio, NULL, size }); // data is set when flushing
+	}
+	else if (_pOnMedia) { // Synchronous read
+		const UInt8* data = spans->data;
+		if (count > 1) { // gather the spans, the callback needs a contiguous packet
+			_mediaBuffer.resize(size, false);
+			for (UInt32 i = 0, offset = 0; i < count; offset += spans[i++].size)
+				memcpy(_mediaBuffer.data() + offset, spans[i].data, spans[i].size);
+			data = _mediaBuffer.data();
+		}
+		_pOnMedia(name().c_str(), stream.c_str(), time, (const char*)data, size, audio);
+	}
+	else { // Asynchronous read
+		{
+			lock_guard<mutex> lock(_mediaWriteMutex);
+			if (!queue.pRing) {
+				queue.pRing.reset(new MediaRing());
+				queue.ready.store(true, memory_order_release);
+			}
+			// Reader too late? Drop the media until the next key frame, then the reader jumps to it (live edge)
+			UInt32 maxDuration = _maxReadDuration;
+			if (maxDuration) {
+				if (!queue.dropping && !queue.skipTo.load(memory_order_acquire) && queue.pRing->duration() > maxDuration) {
+					queue.dropping = true;
+					queue.dropTime = time;
+					DEBUG("Read queue of stream ", stream, " (session ", name(), ") exceeds ", maxDuration, "ms, dropping media until the next key frame")
+				}
+				if (queue.dropping) {
+					if (audio || !RTMFP::IsKeyFrame(spans->data, spans->size))
+						return;
+					queue.dropping = false;
+					UInt32 dropped = queue.pRing->duration() + time - queue.dropTime; // queued media + media not written
+					_droppedDuration += dropped;
+					queue.skipTo.store(queue.pRing->position(), memory_order_release); // the queued tags will be skipped by the reader
+					INFO("Stream ", stream, " of session ", name(), " is back to the live edge, ", dropped, "ms of media dropped")
+				}
+			}
+			if (!queue.pRing->writeTag(audio ? AMF::AUDIO : AMF::VIDEO, time, spans, count, size)) {
+				WARN("Read buffer of stream ", stream, " (session ", name(), ") is full, ", audio ? "audio" : "video", " packet ignored (", queue.pRing->overflows(), " packets ignored)")
+				return;
+			}
+		}
+		handleDataAvailable(true);
+	}
+}
+
+void FlowManager::flushMedia() {
+	if (!_pOnMediaBatch)
+		return;
+
+	// The batch is swapped out under the lock and delivered without lock (the application can call the library or block)
+	// Only one thread delivers at a time, the others request it to deliver their frames too
+	for (;;) {
+		_mediaFlushRequested = true;
+		unique_lock<mutex> lockFlush(_mediaFlushMutex, try_to_lock);
+		if (!lockFlush.owns_lock())
+			return;
+
+		while (_mediaFlushRequested.exchange(false)) {
+			Buffer* pBuffer;
+			{
+				lock_guard<mutex> lock(_mediaBatchMutex);
+				if (_mediaBatch.empty())
+					continue;
+				_mediaBatch.swap(_mediaBatchFlushed);
+				pBuffer = &_mediaBatchBuffers[_mediaBatchIndex];
+				_mediaBatchIndex ^= 1; // the next frames are written in the other buffer
+			}
+
+			// Payloads are contiguous, pointers can be set now that the buffer will not move anymore
+			const char* data = (const char*)pBuffer->data();
+			for (RTMFPMediaFrame& frame : _mediaBatchFlushed) {
+				frame.data = data;
+				data += frame.size;
+			}
+			_pOnMediaBatch(_mediaBatchFlushed.data(), _mediaBatchFlushed.size());
+			_mediaBatchFlushed.clear();
+			pBuffer->resize(0, false);
+		}
+		lockFlush.unlock();
+		if (!_mediaFlushRequested)
+			return; // no frame pushed while we were delivering
+	}
+}
+
 void FlowManager::close(bool abrupt) {
 	if (status == RTMFP::FAILED)
 		return;
@@ -213,50 +299,62 @@ void FlowManager::unsubscribeConnection(shared_ptr<RTMFPConnection>& pConnection
 	pConnection->OnWriterError::unsubscribe(onWriterError);
 }
 
-bool FlowManager::readAsync(UInt8* buf, UInt32 size, int& nbRead) {
+bool FlowManager::readAsync(ReadQueue& queue, UInt8* buf, UInt32 size, int& nbRead) {
 	if (nbRead != 0)
 		ERROR("Parameter nbRead must equal zero in readAsync()")
 	else if (status == RTMFP::CONNECTED) {
 
-		bool available = false;
-		lock_guard<recursive_mutex> lock(_readMutex);
-		if (!_mediaPackets[name()].empty()) {
+		// No lock here : we are the only consumer of the ring
+		MediaRing* pRing = queue.ring();
+		if (pRing)
+			queue.skip(*pRing);
+		if (pRing && !pRing->empty()) {
 			// First read => send header
-			if (_firstRead && size > sizeof(_FlvHeader)) { // TODO: make a real context with a recorded position
+			if (queue.firstRead && size > sizeof(_FlvHeader)) { // TODO: make a real context with a recorded position
 				memcpy(buf, _FlvHeader, sizeof(_FlvHeader));
-				_firstRead = false;
+				queue.firstRead = false;
 				size -= sizeof(_FlvHeader);
 				nbRead += sizeof(_FlvHeader);
 			}
-
-			UInt32 bufferSize = 0, toRead = 0;
-			auto& queue = _mediaPackets[name()];
-			while (!queue.empty() && (nbRead < size)) {
-
-				// Read next packet
-				std::shared_ptr<RTMFPMediaPacket>& packet = queue.front();
-				bufferSize = packet->pBuffer.size() - packet->pos;
-				toRead = (bufferSize > (size - nbRead)) ? size - nbRead : bufferSize;
-				memcpy(buf + nbRead, packet->pBuffer.data() + packet->pos, toRead);
-				nbRead += toRead;
-
-				// If packet too big : save position and exit
-				if (bufferSize > toRead) {
-					packet->pos += toRead;
-					break;
-				}
-				queue.pop_front();
-			}
-			available = !queue.empty();
-			}
-		if (!available)
-			handleDataAvailable(false); // change the available status
+			nbRead += pRing->read(buf + nbRead, size);
+		}
+		updateDataAvailable(pRing);
 		return true;
 	} 
 
 	return false;
 }
 
+bool FlowManager::readPacket(ReadQueue& queue, const UInt8*& tag, UInt32& size) {
+	tag = NULL;
+	if (status != RTMFP::CONNECTED)
+		return false;
+
+	MediaRing* pRing = queue.ring();
+	if (pRing)
+		queue.skip(*pRing);
+	if (!pRing || !(tag = pRing->peek(size)))
+		updateDataAvailable(pRing);
+	return true;
+}
+
+void FlowManager::releasePacket(ReadQueue& queue) {
+	MediaRing* pRing = queue.ring();
+	if (pRing) {
+		pRing->release();
+		updateDataAvailable(pRing);
+	}
+}
+
+void FlowManager::updateDataAvailable(MediaRing* pRing) {
+	if (pRing && !pRing->empty())
+		return;
+
+	handleDataAvailable(false); // change the available status
+	if (pRing && !pRing->empty())
+		handleDataAvailable(true); // a packet has been written in the meantime
+}
+
 void FlowManager::receive(BinaryReader& reader) {
 
 	// Variables for request (0x10 and 0x11)
@@ -407,6 +505,9 @@ void FlowManager::receive(BinaryReader& reader) {
 			pFlow = NULL;
 		}
 	}
+
+	// Deliver the frames received in this packet
+	flushMedia();
 }
 
 RTMFPFlow* FlowManager::createFlow(UInt64 id, const string& signature, UInt64 idWriterRef) {
@@ -447,6 +548,9 @@ RTMFPFlow* FlowManager::createFlow(UInt64 id, const string& signature, UInt64 id
 
 void FlowManager::manage() {
 
+	// Deliver the frames pushed since last reception (NetGroup)
+	flushMedia();
+
 	auto itFlow = _flows.begin();
 	while (itFlow != _flows.end()) {
 		if (itFlow->second->consumed())
@@ -0,0 +1,115 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FlvDemuxer.h"
+#include "Mona/BinaryReader.h"
+#include "Mona/Logs.h"
+
+using namespace Mona;
+using namespace std;
+
+FlvDemuxer::FlvDemuxer() : _header(true) {
+}
+
+void FlvDemuxer::reset() {
+	_header = true;
+	_carry.resize(0, false);
+}
+
+UInt32 FlvDemuxer::fill(const UInt8* data, UInt32 size, UInt32 needed) {
+	UInt32 carried = _carry.size();
+	if (carried >= needed)
+		return 0;
+	if (size > needed - carried)
+		size = needed - carried;
+	_carry.resize(carried + size, true);
+	memcpy(_carry.data() + carried, data, size);
+	return size;
+}
+
+bool FlvDemuxer::deliver(const UInt8* tag, UInt32 size, const OnTag& onTag) {
+	BinaryReader reader(tag, size);
+	UInt8 type = reader.read8();
+	UInt32 bodySize = reader.read24();
+	UInt32 time = reader.read24();
+	time |= reader.read8() << 24; // extended time
+	reader.next(3); // stream id
+
+	UInt32 sizeBis = BinaryReader(tag + FLV_TAG_HEADER_SIZE + bodySize, 4).read32();
+	if (sizeBis != bodySize + FLV_TAG_HEADER_SIZE) {
+		ERROR("Unexpected size found after payload : ", sizeBis, " (expected: ", bodySize + FLV_TAG_HEADER_SIZE, "), tag ignored")
+		return true;
+	}
+	return onTag(type, time, reader.current(), bodySize);
+}
+
+UInt32 FlvDemuxer::parse(const UInt8* data, UInt32 size, const OnTag& onTag) {
+	const UInt8* cur = data;
+	const UInt8* end = data + size;
+
+	for (;;) {
+		if (_header) {
+			if (!_carry.size() && cur == end)
+				break;
+			if (!_carry.size() && (end - cur) >= FLV_HEADER_SIZE) {
+				if (memcmp(cur, "FLV", 3) == 0)
+					cur += FLV_HEADER_SIZE;
+			}
+			else {
+				cur += fill(cur, end - cur, FLV_HEADER_SIZE);
+				if (_carry.size() < FLV_HEADER_SIZE)
+					break; // wait for further data
+				if (memcmp(_carry.data(), "FLV", 3) == 0)
+					_carry.resize(0, false);
+				// otherwise the 13 bytes are the beginning of a tag
+			}
+			_header = false;
+			continue;
+		}
+
+		// Zero-copy : the tag is entirely in the chunk
+		if (!_carry.size()) {
+			UInt32 available = end - cur;
+			if (!available)
+				break;
+			if (available >= FLV_TAG_HEADER_SIZE) {
+				UInt32 tagSize = TagSize(cur);
+				if (available >= tagSize) {
+					if (!deliver(cur, tagSize, onTag))
+						break;
+					cur += tagSize;
+					continue;
+				}
+			}
+		}
+
+		// Incomplete tag : keep it until the end is received
+		cur += fill(cur, end - cur, FLV_TAG_HEADER_SIZE);
+		if (_carry.size() < FLV_TAG_HEADER_SIZE)
+			break; // wait for further data
+		UInt32 tagSize = TagSize(_carry.data());
+		cur += fill(cur, end - cur, tagSize);
+		if (_carry.size() < tagSize || !deliver(_carry.data(), tagSize, onTag))
+			break; // wait for further data or stopped by the caller
+		_carry.resize(0, false);
+	}
+	return cur - data;
+}
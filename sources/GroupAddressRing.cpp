@@ -0,0 +1,129 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GroupAddressRing.h"
+#include <algorithm>
+
+using namespace Mona;
+using namespace std;
+
+GroupAddressRing::GroupAddressRing() : _sorted(0), _count(0), _erased(false), _version(1), _estimatedCount(0) {
+	memset(_estimatedAddress, 0, GROUP_ADDRESS_SIZE);
+}
+
+UInt64 GroupAddressRing::Prefix(const UInt8* address) {
+	UInt64 value = 0;
+	for (int i = 0; i < 8; ++i)
+		value = (value << 8) | address[i];
+	return value;
+}
+
+void GroupAddressRing::add(const UInt8* address, const PeerId& peerId) {
+	_entries.emplace_back();
+	memcpy(_entries.back().address, address, GROUP_ADDRESS_SIZE);
+	_entries.back().pPeerId = &peerId;
+	++_count;
+	++_version;
+	_estimatedCount = 0;
+}
+
+bool GroupAddressRing::erase(const UInt8* address) {
+	Entry key;
+	memcpy(key.address, address, GROUP_ADDRESS_SIZE);
+
+	// Sorted entries : only mark it (marked entries stay in order), the array is compacted once at the next read
+	bool found(false);
+	auto itSorted = _entries.begin() + _sorted;
+	for (auto it = lower_bound(_entries.begin(), itSorted, key, Less); it != itSorted && !Less(key, *it); ++it) {
+		if (it->pPeerId) {
+			it->pPeerId = NULL;
+			_erased = found = true;
+			break;
+		}
+	}
+	// New entries (not sorted) : replaced by the last one
+	for (auto it = itSorted; !found && it != _entries.end(); ++it) {
+		if (memcmp(it->address, address, GROUP_ADDRESS_SIZE) == 0) {
+			*it = _entries.back();
+			_entries.pop_back();
+			found = true;
+		}
+	}
+	if (!found)
+		return false;
+
+	--_count;
+	++_version;
+	_estimatedCount = 0;
+	return true;
+}
+
+void GroupAddressRing::update() {
+	if (_erased) {
+		// Sorted and new entries keep their relative order
+		UInt32 sorted = 0;
+		for (UInt32 i = 0; i < _sorted; ++i)
+			sorted += _entries[i].pPeerId != NULL;
+		_entries.erase(remove_if(_entries.begin(), _entries.end(), [](const Entry& entry) { return !entry.pPeerId; }), _entries.end());
+		_sorted = sorted;
+		_erased = false;
+	}
+	if (_sorted < _entries.size()) {
+		sort(_entries.begin() + _sorted, _entries.end(), Less);
+		inplace_merge(_entries.begin(), _entries.begin() + _sorted, _entries.end(), Less);
+		_sorted = _entries.size();
+	}
+}
+
+UInt32 GroupAddressRing::lowerBound(const UInt8* address) {
+	update();
+	Entry key;
+	memcpy(key.address, address, GROUP_ADDRESS_SIZE);
+	return (UInt32)(lower_bound(_entries.begin(), _entries.end(), key, Less) - _entries.begin());
+}
+
+double GroupAddressRing::estimatedCount(const UInt8* address) {
+	if (_count < 4)
+		return _count;
+	if (_estimatedCount && memcmp(_estimatedAddress, address, GROUP_ADDRESS_SIZE) == 0)
+		return _estimatedCount;
+
+	// First get the neighbors N-2 and N+2
+	UInt32 first = lowerBound(address), last;
+	if (first == _count) { // we are after the last address
+		first = _count - 2;
+		last = 1;
+	}
+	else if (memcmp(_entries[first].address, address, GROUP_ADDRESS_SIZE) > 0) { // first == N+1
+		last = move(first, 1);
+		first = move(first, -2);
+	}
+	else { // first == N
+		last = move(first, 2);
+		first = move(first, -1);
+	}
+
+	// Then calculate the total (the distance is modulo 2^64 around the ring)
+	UInt64 distance = Prefix(_entries[last].address) - Prefix(_entries[first].address);
+	_estimatedCount = (0xFFFFFFFFFFFFFFFF / (double(distance) / 4)) + 1;
+	memcpy(_estimatedAddress, address, GROUP_ADDRESS_SIZE);
+	return _estimatedCount;
+}
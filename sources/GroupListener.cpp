@@ -52,16 +52,16 @@ void GroupListener::stopPublishing() {
 }
 
 
-void GroupListener::pushVideo(UInt32 time, const UInt8* data, UInt32 size) {
+void GroupListener::pushVideo(UInt32 time, const UInt8* data, UInt32 size, bool keyFrame) {
 
 	if (!_codecInfosSent) {
-		if (!pushVideoInfos(time, data, size)) {
+		if (!pushVideoInfos(time, data, size, keyFrame)) {
 			DEBUG("Video frame dropped to wait first key frame");
 			return;
 		}
 	}
 	// Send codec infos periodically (ffmpeg issue)
-	else if (_lastCodecsTime.isElapsed(5000) && pushVideoInfos(time, data, size)) {
+	else if (_lastCodecsTime.isElapsed(5000) && pushVideoInfos(time, data, size, keyFrame)) {
 		// TODO: make the time configurable
 		_lastCodecsTime.update();
 	}
@@ -77,15 +77,15 @@ void GroupListener::pushVideo(UInt32 time, const UInt8* data, UInt32 size) {
 	time -= _startTime;
 	//TRACE("Video time(+seekTime) => ", time, "(+", _seekTime, "), size : ", size);
 
-	OnMedia::raise(RTMFP::IsKeyFrame(data, size) || _reliable, AMF::VIDEO, _lastTime = (time + _seekTime), data, size);
+	OnMedia::raise(keyFrame || _reliable, AMF::VIDEO, _lastTime = (time + _seekTime), data, size);
 }
 
-bool GroupListener::pushVideoInfos(UInt32 time, const UInt8* data, UInt32 size) {
-	if (RTMFP::IsKeyFrame(data, size)) {
+bool GroupListener::pushVideoInfos(UInt32 time, const UInt8* data, UInt32 size, bool keyFrame) {
+	if (keyFrame) {
 		_codecInfosSent = true;
 		if (!publication.videoCodecBuffer().empty() && !RTMFP::IsH264CodecInfos(data, size)) {
 			INFO("H264 codec infos sent to one listener of ", publication.name(), " publication")
-			pushVideo(time, publication.videoCodecBuffer()->data(), publication.videoCodecBuffer()->size());
+			pushVideo(time, publication.videoCodecBuffer()->data(), publication.videoCodecBuffer()->size(), true);
 		}
 		return true;
 	}
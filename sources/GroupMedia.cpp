@@ -23,6 +23,7 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "NetGroup.h"
 #include "GroupStream.h"
 #include "librtmfp.h"
+#include <algorithm>
 
 using namespace Mona;
 using namespace std;
@@ -31,7 +32,7 @@ using namespace std;
 class MediaPacket : public virtual Object {
 public:
 	MediaPacket(const PoolBuffers& poolBuffers, const UInt8* data, UInt32 size, UInt32 totalSize, UInt32 time, AMF::ContentType mediaType,
-		UInt64 fragmentId, UInt8 groupMarker, UInt8 splitId) : splittedId(splitId), type(mediaType), marker(groupMarker), time(time), pBuffer(poolBuffers, totalSize) {
+		UInt64 fragmentId, UInt8 groupMarker, UInt8 splitId) : splittedId(splitId), type(mediaType), marker(groupMarker), time(time), received(Time::Now()), pBuffer(poolBuffers, totalSize) {
 		BinaryWriter writer(pBuffer->data(), totalSize);
 
 		// AMF Group marker
@@ -54,8 +55,16 @@ public:
 		writer.write(data, size);
 	}
 
+	// Fragment received from a peer, the wire message is copied as is to be relayed without serializing it again
+	MediaPacket(const PoolBuffers& poolBuffers, PacketReader& message, UInt32 time, AMF::ContentType mediaType, UInt8 groupMarker, UInt8 splitId) : 
+		splittedId(splitId), type(mediaType), marker(groupMarker), time(time), received(Time::Now()), pBuffer(poolBuffers, message.size()) {
+		memcpy(pBuffer->data(), message.data(), message.size());
+		payload = pBuffer->data() + message.position();
+	}
+
 	UInt32 payloadSize() { return pBuffer.size() - (payload - pBuffer.data()); }
 
+	Int64				received; // Time of reception or creation
 	PoolBuffer			pBuffer;
 	UInt32				time;
 	AMF::ContentType	type;
@@ -67,37 +76,31 @@ public:
 Buffer	GroupMedia::_fragmentsMapBuffer;
 UInt32	GroupMedia::GroupMediaCounter = 0;
 
-GroupMedia::GroupMedia(const PoolBuffers& poolBuffers, const string& name, const string& key, std::shared_ptr<RTMFPGroupConfig> parameters) : _fragmentCounter(0), _firstPushMode(true), _currentPushMask(0), 
+GroupMedia::GroupMedia(const PoolBuffers& poolBuffers, const string& name, const string& key, std::shared_ptr<RTMFPGroupConfig> parameters) : _fragmentCounter(0), _firstPushMode(true), _currentPushMask(0), _pushInCount(0), _pushInDuplicates(0), 
 	_currentPullFragment(0), _itPullPeer(_mapPeers.end()), _itPushPeer(_mapPeers.end()), _itFragmentsPeer(_mapPeers.end()), _lastFragmentMapId(0), _firstPullReceived(false), _poolBuffers(poolBuffers), 
 	_stream(name), _streamKey(key), groupParameters(parameters), id(++GroupMediaCounter) {
 
 	onPeerClose = [this](const string& peerId, UInt8 mask) {
-		// unset push masks
-		if (mask) {
-			for (UInt8 i = 0; i < 8; i++) {
-				if (mask & (1 << i)) {
-					auto itPush = _mapPushMasks.find(1 << i);
-					if (itPush != _mapPushMasks.end() && itPush->second.first == peerId)
-						_mapPushMasks.erase(itPush);
-				}
-			}
-		}
-		removePeer(peerId);
+		removePeer(peerId); // push masks of the peer will be assigned to other peers by sendPushRequests()
 	};
 	onPlayPull = [this](PeerMedia* pPeer, UInt64 index) {
 
-		auto itFragment = _fragments.find(index);
-		if (itFragment == _fragments.end()) {
+		MediaPacket* pFragment = _fragments.find(index);
+		if (!pFragment) {
 			DEBUG("GroupMedia ", id, " - Peer is asking for an unknown Fragment (", index, "), possibly deleted")
 			return;
 		}
 
 		// Send fragment to peer (pull mode)
-		pPeer->sendMedia(itFragment->second.pBuffer.data(), itFragment->second.pBuffer.size(), itFragment->first, true);
+		pPeer->sendMedia(pFragment->pBuffer.data(), pFragment->pBuffer.size(), index, true);
 	};
 	onFragmentsMap = [this](UInt64 counter) {
 		if (groupParameters->isPublisher)
 			return false; // ignore the request
+		if (isFragmentTooFar(counter)) {
+			DEBUG("GroupMedia ", id, " - Fragments map ignored, fragment ", counter, " is too far from the last fragment known")
+			return false;
+		}
 
 		// Record the idenfier for future pull requests
 		if (_lastFragmentMapId < counter) {
@@ -118,26 +121,33 @@ GroupMedia::GroupMedia(const PoolBuffers& poolBuffers, const string& name, const
 		UInt8 splitCounter = size / NETGROUP_MAX_PACKET_SIZE - ((size % NETGROUP_MAX_PACKET_SIZE) == 0);
 		UInt8 marker = GroupStream::GROUP_MEDIA_DATA ;
 		TRACE("GroupMedia ", id, " - Creating fragments ", _fragmentCounter + 1, " to ", _fragmentCounter + 1 + splitCounter, " - time : ", time)
-		auto itFragment = _fragments.end();
 		do {
 			if (size > NETGROUP_MAX_PACKET_SIZE)
 				marker = splitCounter == 0 ? GroupStream::GROUP_MEDIA_END : (pos == data ? GroupStream::GROUP_MEDIA_START : GroupStream::GROUP_MEDIA_NEXT);
 
 			// Add the fragment to the map
 			UInt32 fragmentSize = ((splitCounter > 0) ? NETGROUP_MAX_PACKET_SIZE : (end - pos));
-			addFragment(itFragment, NULL, marker, ++_fragmentCounter, splitCounter, type, time, pos, fragmentSize);
+			addFragment(marker, ++_fragmentCounter, splitCounter, type, time, pos, fragmentSize);
 
 			pos += splitCounter > 0 ? NETGROUP_MAX_PACKET_SIZE : (end - pos);
 		} while (splitCounter-- > 0);
 
 	};
 	onFragment = [this](PeerMedia* pPeer, const string& peerId, UInt8 marker, UInt64 fragmentId, UInt8 splitedNumber, UInt8 mediaType, UInt32 time, PacketReader& packet, double lostRate) {
+		if (isFragmentTooFar(fragmentId)) {
+			DEBUG("GroupMedia ", id, " - Fragment ", fragmentId, " received from ", peerId, " ignored, it is too far from the last fragment known")
+			return;
+		}
 
 		// Pull fragment?
-		auto itWaiting = _mapWaitingFragments.find(fragmentId);
-		if (itWaiting != _mapWaitingFragments.end()) {
+		PullRequest* pWaiting = _waitingFragments.find(fragmentId);
+		if (pWaiting) {
 			TRACE("GroupMedia ", id, " - Waiting fragment ", fragmentId, " is arrived")
-			_mapWaitingFragments.erase(itWaiting);
+			auto itRequested = _mapPeers.find(pWaiting->peerId);
+			if (itRequested != _mapPeers.end())
+				itRequested->second->endPull(itRequested->second.get() == pPeer ? PeerMedia::PULL_RECEIVED : PeerMedia::PULL_CANCELLED);
+			addPullTime((UInt32)pWaiting->start.elapsed());
+			_waitingFragments.erase(fragmentId);
 			if (!_firstPullReceived)
 				_firstPullReceived = true;
 		}
@@ -147,44 +157,27 @@ GroupMedia::GroupMedia(const PoolBuffers& poolBuffers, const string& name, const
 			if (pPeer->pushInMode & mask) {
 				TRACE("GroupMedia ", id, " - Push In fragment received from ", peerId, " : ", fragmentId, " ; mask : ", Format<UInt8>("%.2x", mask))
 
-				auto itPushMask = _mapPushMasks.lower_bound(mask);
-				// first push with this mask?
-				if (itPushMask == _mapPushMasks.end() || itPushMask->first != mask)
-					_mapPushMasks.emplace_hint(itPushMask, piecewise_construct, forward_as_tuple(mask), forward_as_tuple(peerId.c_str(), fragmentId));
-				else {
-					if (itPushMask->second.first != peerId) {
-						// Peer is faster?
-						if (itPushMask->second.second < fragmentId) {
-							TRACE("GroupMedia ", id, " - Push In - Updating the pusher, last peer was ", itPushMask->second.first)
-							auto itOldPeer = _mapPeers.find(itPushMask->second.first);
-							if (itOldPeer != _mapPeers.end())
-								itOldPeer->second->sendPushMode(itOldPeer->second->pushInMode - mask);
-							itPushMask->second.first = peerId.c_str();
-						}
-						else {
-							TRACE("GroupMedia ", id, " - Push In - Tested pusher is slower than current one, resetting mask...")
-							pPeer->sendPushMode(pPeer->pushInMode - mask);
-						}
-					}
-					if (itPushMask->second.second < fragmentId)
-						itPushMask->second.second = fragmentId; // update the last id received for this mask
-				}
+				// Record the delay compared to the first copy of the fragment
+				MediaPacket* pFragment = _fragments.find(fragmentId);
+				pPeer->addPushDelay(fragmentId % 8, pFragment ? (UInt32)(Time::Now() - pFragment->received) : 0);
+				++_pushInCount;
+				if (pFragment)
+					++_pushInDuplicates;
 			}
 			else
 				DEBUG("GroupMedia ", id, " - Unexpected fragment received from ", peerId, " : ", fragmentId, " ; mask : ", Format<UInt8>("%.2x", mask))
 		}
 
-		auto itFragment = _fragments.lower_bound(fragmentId);
-		if (itFragment != _fragments.end() && itFragment->first == fragmentId) {
+		if (_fragments.has(fragmentId)) {
 			TRACE("GroupMedia ", id, " - Fragment ", fragmentId, " already received, ignored")
 			return;
 		}
 
-		// Add the fragment to the map
-		addFragment(itFragment, pPeer, marker, fragmentId, splitedNumber, mediaType, time, packet.current(), packet.available());
+		// Add the fragment to the ring
+		addFragment(pPeer, marker, fragmentId, splitedNumber, mediaType, time, packet);
 
 		// Push the fragment to the output file (if ordered)
-		pushFragment(itFragment);
+		pushFragment(fragmentId);
 	};
 }
 
@@ -199,22 +192,40 @@ GroupMedia::~GroupMedia() {
 	_mapTime2Fragment.clear();
 }
 
-void GroupMedia::addFragment(MAP_FRAGMENTS_ITERATOR& itFragment, PeerMedia* pPeer, UInt8 marker, UInt64 id, UInt8 splitedNumber, UInt8 mediaType, UInt32 time, const UInt8* data, UInt32 size) {
+void GroupMedia::addFragment(UInt8 marker, UInt64 id, UInt8 splitedNumber, UInt8 mediaType, UInt32 time, const UInt8* data, UInt32 size) {
 	UInt32 bufferSize = size + 1 + 5 * (marker == GroupStream::GROUP_MEDIA_START || marker == GroupStream::GROUP_MEDIA_DATA) + (splitedNumber > 0) + Util::Get7BitValueSize(id);
-	itFragment = _fragments.emplace_hint(itFragment, piecewise_construct, forward_as_tuple(id), forward_as_tuple(_poolBuffers, data, size, bufferSize, time, (AMF::ContentType)mediaType,
-		id, marker, splitedNumber));
+	MediaPacket* pFragment = _fragments.emplace(id, _poolBuffers, data, size, bufferSize, time, (AMF::ContentType)mediaType, id, marker, splitedNumber);
+	if (!pFragment) {
+		DEBUG("GroupMedia ", this->id, " - Fragment ", id, " is too old, ignored")
+		return;
+	}
+	pushToPeers(NULL, id, *pFragment);
+}
+
+void GroupMedia::addFragment(PeerMedia* pPeer, UInt8 marker, UInt64 id, UInt8 splitedNumber, UInt8 mediaType, UInt32 time, PacketReader& message) {
+	MediaPacket* pFragment = _fragments.emplace(id, _poolBuffers, message, time, (AMF::ContentType)mediaType, marker, splitedNumber);
+	if (!pFragment) {
+		DEBUG("GroupMedia ", this->id, " - Fragment ", id, " is too old, ignored")
+		return;
+	}
+	pushToPeers(pPeer, id, *pFragment);
+}
+
+void GroupMedia::pushToPeers(PeerMedia* pPeer, UInt64 id, MediaPacket& fragment) {
 
 	// Send fragment to peers (push mode)
 	UInt8 nbPush = groupParameters->pushLimit + 1;
 	for (auto it : _mapPeers) {
-		if (it.second.get() != pPeer && it.second->sendMedia(itFragment->second.pBuffer.data(), itFragment->second.pBuffer.size(), id) && (--nbPush == 0)) {
+		if (it.second.get() != pPeer && it.second->sendMedia(fragment.pBuffer.data(), fragment.pBuffer.size(), id) && (--nbPush == 0)) {
 			TRACE("GroupMedia ", id, " - Push limit (", groupParameters->pushLimit + 1, ") reached for fragment ", id, " (mask=", Format<UInt8>("%.2x", 1 << (id % 8)), ")")
 			break;
 		}
 	}
 
-	if ((marker == GroupStream::GROUP_MEDIA_DATA || marker == GroupStream::GROUP_MEDIA_START) && (_mapTime2Fragment.empty() || time > _mapTime2Fragment.rbegin()->first))
-		_mapTime2Fragment[time] = id;
+	// The index stays sorted : a fragment not newer than the last one referenced (pulled late) is not referenced,
+	// eraseOldFragments() then only keeps a few more fragments
+	if ((fragment.marker == GroupStream::GROUP_MEDIA_DATA || fragment.marker == GroupStream::GROUP_MEDIA_START) && (_mapTime2Fragment.empty() || fragment.time > _mapTime2Fragment.back().first))
+		_mapTime2Fragment.emplace_back(fragment.time, id);
 }
 
 void GroupMedia::manage() {
@@ -252,11 +263,12 @@ void GroupMedia::manage() {
 }
 
 void GroupMedia::addPeer(const string& peerId, shared_ptr<PeerMedia>& pPeer) {
-	auto itPeer = _mapPeers.lower_bound(peerId);
-	if (itPeer != _mapPeers.end() && itPeer->first == peerId)
+	PeerId key(peerId);
+	auto itPeer = _mapPeers.lower_bound(key);
+	if (itPeer != _mapPeers.end() && itPeer->first == key)
 		return;
 
-	_mapPeers.emplace(peerId, pPeer);
+	_mapPeers.emplace_hint(itPeer, key, pPeer);
 	pPeer->OnPeerClose::subscribe(onPeerClose);
 	pPeer->OnPlayPull::subscribe(onPlayPull);
 	pPeer->OnFragmentsMap::subscribe(onFragmentsMap);
@@ -311,49 +323,42 @@ void GroupMedia::eraseOldFragments() {
 	if (_fragments.empty())
 		return;
 
-	UInt32 end = _fragments.rbegin()->second.time;
+	UInt32 end = _fragments.last().time;
 	UInt32 time2Keep = end - (groupParameters->windowDuration + groupParameters->relayMargin);
-	auto itTime = _mapTime2Fragment.lower_bound(time2Keep);
+	auto itTime = lower_bound(_mapTime2Fragment.begin(), _mapTime2Fragment.end(), time2Keep, [](const pair<UInt32, UInt64>& entry, UInt32 time) { return entry.first < time; });
 
-	// To not delete more than the window duration
-	if (itTime != _mapTime2Fragment.end() && time2Keep > itTime->first)
-		--itTime;
-		
 	// Ignore if no fragment found or if it is the first reference
 	if (itTime == _mapTime2Fragment.end() || itTime == _mapTime2Fragment.begin())
 		return;
 
-	auto itFragment = _fragments.find(itTime->second);
-	if (itFragment == _fragments.end()) {
+	if (!_fragments.has(itTime->second)) {
 		ERROR("GroupMedia ", id, " - Unable to find the fragment ", itTime->second, " for cleaning buffer") // implementation error
 		return;
 	}
+	if (itTime->second == _fragments.firstId())
+		return; // nothing to delete
 
 	// Get the first fragment before the itTime reference
-	--itFragment;
-	if (_fragmentCounter < itFragment->first) {
-		WARN("GroupMedia ", id, " - Deleting unread fragments to keep the window duration... (", itFragment->first - _fragmentCounter, " fragments ignored)")
-		_fragmentCounter = itFragment->first;
+	UInt64 firstFragment = itTime->second - 1;
+	while (!_fragments.has(firstFragment))
+		--firstFragment;
+	if (_fragmentCounter < firstFragment) {
+		WARN("GroupMedia ", id, " - Deleting unread fragments to keep the window duration... (", firstFragment - _fragmentCounter, " fragments ignored)")
+		_fragmentCounter = firstFragment;
 	}
 
-	DEBUG("GroupMedia ", id, " - Deletion of fragments ", _fragments.begin()->first, " (~", _mapTime2Fragment.begin()->first, ") to ",
-		itFragment->first, " (~", itTime->first, ") - current time : ", end)
-	_fragments.erase(_fragments.begin(), itFragment);
+	DEBUG("GroupMedia ", id, " - Deletion of fragments ", _fragments.firstId(), " (~", _mapTime2Fragment.front().first, ") to ",
+		firstFragment, " (~", itTime->first, ") - current time : ", end)
+	_fragments.eraseBefore(firstFragment);
 	_mapTime2Fragment.erase(_mapTime2Fragment.begin(), itTime);
 
 	// Delete the old waiting fragments
-	auto itWait = _mapWaitingFragments.lower_bound(itFragment->first);
-	if (!_mapWaitingFragments.empty() && _mapWaitingFragments.begin()->first < itFragment->first) {
-		WARN("GroupMedia ", id, " - Deletion of waiting fragments ", _mapWaitingFragments.begin()->first, " to ", (itWait == _mapWaitingFragments.end())? _mapWaitingFragments.rbegin()->first : itWait->first)
-		_mapWaitingFragments.erase(_mapWaitingFragments.begin(), itWait);
-	}
-	if (_currentPullFragment < itFragment->first)
-		_currentPullFragment = itFragment->first; // move the current pull fragment to the 1st fragment
+	cancelPullRequests(firstFragment);
+	if (_currentPullFragment < firstFragment)
+		_currentPullFragment = firstFragment; // move the current pull fragment to the 1st fragment
 
 	// Try to push again the last fragments
-	auto itLast = _fragments.find(_fragmentCounter + 1);
-	if (itLast != _fragments.end())
-		pushFragment(itLast);
+	pushFragment(_fragmentCounter + 1);
 }
 
 UInt64 GroupMedia::updateFragmentMap() {
@@ -364,8 +369,8 @@ UInt64 GroupMedia::updateFragmentMap() {
 	eraseOldFragments();
 
 	// Generate the report message
-	UInt64 firstFragment = _fragments.begin()->first;
-	UInt64 lastFragment = _fragments.rbegin()->first;
+	UInt64 firstFragment = _fragments.firstId();
+	UInt64 lastFragment = _fragments.lastId();
 	UInt64 nbFragments = lastFragment - firstFragment; // number of fragments - the first one
 	_fragmentsMapBuffer.resize((UInt32)((nbFragments / 8) + ((nbFragments % 8) > 0)) + Util::Get7BitValueSize(lastFragment) + 1, false);
 	BinaryWriter writer(BIN _fragmentsMapBuffer.data(), _fragmentsMapBuffer.size());
@@ -387,12 +392,19 @@ UInt64 GroupMedia::updateFragmentMap() {
 		writer.write8(lastByte);
 	}
 	else {
-		// Loop on each bit
-		for (UInt64 index = lastFragment - 1; index >= firstFragment && index >= 8; index -= 8) {
+		// Write 8 bytes per presence word, each byte gives the availability of fragments index to index - 7
+		UInt64 index = lastFragment - 1;
+		for (; index >= firstFragment + 63 && index >= 64; index -= 64) {
+			UInt64 word = _fragments.presence(index);
+			for (UInt8 i = 0; i < 8; ++i, word >>= 8)
+				writer.write8((UInt8)word);
+		}
+		// Last bytes (first fragments of the window)
+		for (; index >= firstFragment && index >= 8; index -= 8) {
 
 			UInt8 currentByte = 0;
 			for (UInt8 fragment = 0; fragment < 8 && (index-fragment) >= firstFragment; fragment++) {
-				if (_fragments.find(index - fragment) != _fragments.end())
+				if (_fragments.has(index - fragment))
 					currentByte += (1 << fragment);
 			}
 			writer.write8(currentByte);
@@ -402,96 +414,142 @@ UInt64 GroupMedia::updateFragmentMap() {
 	return lastFragment;
 }
 
-bool GroupMedia::pushFragment(map<UInt64, MediaPacket>::iterator& itFragment) {
-	if (itFragment == _fragments.end() || !_firstPullReceived)
-		return false;
+void GroupMedia::pushFragment(UInt64 idFragment) {
+	if (!_firstPullReceived)
+		return;
 
-	// Stand alone fragment (special case : sometime Flash send media END without splitted fragments)
-	if (itFragment->second.marker == GroupStream::GROUP_MEDIA_DATA || (itFragment->second.marker == GroupStream::GROUP_MEDIA_END && itFragment->first == _fragmentCounter + 1)) {
-		// Is it the next fragment?
-		if (_fragmentCounter == 0 || itFragment->first == _fragmentCounter + 1) {
-			_fragmentCounter = itFragment->first;
+	MediaPacket* pFragment;
+	while ((pFragment = _fragments.find(idFragment))) {
 
-			TRACE("GroupMedia ", id, " - Pushing Media Fragment ", itFragment->first)
-			if (itFragment->second.type == AMF::AUDIO || itFragment->second.type == AMF::VIDEO)
-				OnGroupPacket::raise(itFragment->second.time, itFragment->second.payload, itFragment->second.payloadSize(), 0, itFragment->second.type == AMF::AUDIO);
+		// Stand alone fragment (special case : sometime Flash send media END without splitted fragments)
+		if (pFragment->marker == GroupStream::GROUP_MEDIA_DATA || (pFragment->marker == GroupStream::GROUP_MEDIA_END && idFragment == _fragmentCounter + 1)) {
+			// Is it the next fragment?
+			if (_fragmentCounter != 0 && idFragment != _fragmentCounter + 1)
+				return;
+			_fragmentCounter = idFragment;
 
-			return pushFragment(++itFragment); // Go to next fragment
+			TRACE("GroupMedia ", id, " - Pushing Media Fragment ", idFragment)
+			if (pFragment->type == AMF::AUDIO || pFragment->type == AMF::VIDEO) {
+				MediaSpan span(pFragment->payload, pFragment->payloadSize());
+				OnGroupPacket::raise(_stream, pFragment->time, &span, 1, span.size, 0, pFragment->type == AMF::AUDIO);
+			}
+			++idFragment; // Go to next fragment
+			continue;
 		}
-	}
-	// Splitted packet
-	else  {
+
+		// Splitted packet
 		if (_fragmentCounter == 0) {
 			// Delete first splitted fragments
-			if (itFragment->second.marker != GroupStream::GROUP_MEDIA_START) {
-				TRACE("GroupMedia ", id, " - Ignoring splitted fragment ", itFragment->first, ", we are waiting for a starting fragment")
-				_fragments.erase(itFragment);
-				return false;
-			}
-			else {
-				TRACE("GroupMedia ", id, " - First fragment is a Start Media Fragment")
-				_fragmentCounter = itFragment->first-1; // -1 to be catched by the next fragment condition 
+			if (pFragment->marker != GroupStream::GROUP_MEDIA_START) {
+				TRACE("GroupMedia ", id, " - Ignoring splitted fragment ", idFragment, ", we are waiting for a starting fragment")
+				_fragments.erase(idFragment);
+				return;
 			}
+			TRACE("GroupMedia ", id, " - First fragment is a Start Media Fragment")
+			_fragmentCounter = idFragment-1; // -1 to be catched by the next fragment condition 
 		}
 
 		// Search the start fragment
-		auto itStart = itFragment;
-		while (itStart->second.marker != GroupStream::GROUP_MEDIA_START) {
-			itStart = _fragments.find(itStart->first - 1);
-			if (itStart == _fragments.end())
-				return false; // ignore these fragments if there is a hole
-		}
-		
-		// Check if all splitted fragments are present
-		UInt8 nbFragments = itStart->second.splittedId+1;
-		UInt32 payloadSize = itStart->second.payloadSize();
-		auto itEnd = itStart;
-		for (int i = 1; i < nbFragments; ++i) {
-			itEnd = _fragments.find(itStart->first + i);
-			if (itEnd == _fragments.end())
-				return false; // ignore these fragments if there is a hole
-
-			payloadSize += itEnd->second.payloadSize();
+		UInt64 idStart = idFragment;
+		MediaPacket* pStart = pFragment;
+		while (pStart->marker != GroupStream::GROUP_MEDIA_START) {
+			if (!(pStart = _fragments.find(--idStart)))
+				return; // ignore these fragments if there is a hole
 		}
 
 		// Is it the next fragment?
-		if (itStart->first == _fragmentCounter + 1) {
-			_fragmentCounter = itEnd->first;
-
-			// Buffer the fragments and write to file if audio/video
-			if (itStart->second.type == AMF::AUDIO || itStart->second.type == AMF::VIDEO) {
-				Buffer	payload(payloadSize);
-				BinaryWriter writer(payload.data(), payloadSize);
-				auto	itCurrent = itStart;
-
-				do {
-					writer.write(itCurrent->second.payload, itCurrent->second.payloadSize());
-				} while (itCurrent++ != itEnd);
+		if (idStart != _fragmentCounter + 1)
+			return;
 
-				TRACE("GroupMedia ", id, " - Pushing splitted packet ", itStart->first, " - ", nbFragments, " fragments for a total size of ", payloadSize)
-				OnGroupPacket::raise(itStart->second.time, payload.data(), payloadSize, 0, itStart->second.type == AMF::AUDIO);
-			}
+		// Check if all splitted fragments are present and reference their payloads
+		UInt32 nbFragments = pStart->splittedId + 1;
+		UInt32 payloadSize = 0;
+		_spans.clear();
+		for (UInt64 idCurrent = idStart; idCurrent < idStart + nbFragments; ++idCurrent) {
+			MediaPacket* pCurrent = (idCurrent == idStart) ? pStart : _fragments.find(idCurrent);
+			if (!pCurrent)
+				return; // ignore these fragments if there is a hole
+			_spans.emplace_back(pCurrent->payload, pCurrent->payloadSize());
+			payloadSize += pCurrent->payloadSize();
+		}
+		_fragmentCounter = idStart + nbFragments - 1;
 
-			return pushFragment(++itEnd);
+		// Deliver the payloads without gathering them if audio/video
+		if (pStart->type == AMF::AUDIO || pStart->type == AMF::VIDEO) {
+			TRACE("GroupMedia ", id, " - Pushing splitted packet ", idStart, " - ", nbFragments, " fragments for a total size of ", payloadSize)
+			OnGroupPacket::raise(_stream, pStart->time, _spans.data(), nbFragments, payloadSize, 0, pStart->type == AMF::AUDIO);
 		}
+		idFragment = _fragmentCounter + 1;
 	}
-
-	return false;
 }
 
 void GroupMedia::sendPushRequests() {
 	if (!_mapPeers.empty()) {
 
-		// First bit mask is random, next are incremental
+		// Choose the best pusher of each mask (lowest delay compared to the first copies) and stop the others
+		map<PeerMedia*, UInt8> modes;
+		for (auto& itPeer : _mapPeers)
+			modes.emplace(itPeer.second.get(), itPeer.second->pushInMode);
+		for (UInt8 bit = 0; bit < 8; ++bit) {
+			UInt8 mask = 1 << bit;
+			PeerMedia* pBest = NULL;
+			for (auto& itPeer : _mapPeers) {
+				PeerMedia* pPeer = itPeer.second.get();
+				if ((pPeer->pushInMode & mask) && pPeer->pushCount(bit) && (!pBest || pPeer->pushDelay(bit) < pBest->pushDelay(bit)))
+					pBest = pPeer;
+			}
+			if (!pBest)
+				continue; // no fragment received, keep the pushers
+			for (auto& itMode : modes) {
+				if (itMode.first != pBest && (itMode.second & mask)) {
+					TRACE("GroupMedia ", id, " - Push In - Resetting mask ", Format<UInt8>("%.2x", mask), " of a slower pusher (", itMode.first->pushDelay(bit), "ms behind)")
+					itMode.second &= ~mask;
+				}
+			}
+		}
+
+		// Spread the masks without pusher over the peers by best score (round-robin, peers without mask first)
+		UInt8 freeMasks = 0xFF;
+		for (auto& itMode : modes)
+			freeMasks &= ~itMode.second;
+		if (freeMasks) {
+			vector<pair<double, PeerMedia*>> candidates;
+			for (auto& itMode : modes) {
+				if (!itMode.second)
+					candidates.emplace_back(itMode.first->pullScore(), itMode.first);
+			}
+			if (candidates.empty()) { // all the peers are already pushing, share the load between them
+				for (auto& itMode : modes)
+					candidates.emplace_back(itMode.first->pullScore(), itMode.first);
+			}
+			sort(candidates.begin(), candidates.end());
+			UInt32 index = 0;
+			for (UInt8 bit = 0; bit < 8; ++bit) {
+				UInt8 mask = 1 << bit;
+				if (freeMasks & mask) {
+					TRACE("GroupMedia ", id, " - Push In - Assigning mask ", Format<UInt8>("%.2x", mask), " to a peer of score ", candidates[index].first)
+					modes[candidates[index].second] |= mask;
+					index = (index + 1) % candidates.size();
+				}
+			}
+		}
+
+		// Test a new pusher for one mask (first bit mask is random, next are incremental)
 		_currentPushMask = (!_currentPushMask) ? 1 << (Util::Random<UInt8>() % 8) : ((_currentPushMask == 0x80) ? 1 : _currentPushMask << 1);
 		TRACE("GroupMedia ", id, " - Push In - Current mask is ", Format<UInt8>("%.2x", _currentPushMask))
-
-		// Get the next peer & send the push request
 		if ((_itPushPeer == _mapPeers.end() && RTMFP::getRandomIt<MAP_PEERS_INFO_TYPE, MAP_PEERS_INFO_ITERATOR_TYPE>(_mapPeers, _itPushPeer, [this](const MAP_PEERS_INFO_ITERATOR_TYPE& it) { return !(it->second->pushInMode & _currentPushMask); }))
 				|| getNextPeer(_itPushPeer, false, 0, _currentPushMask))
-			_itPushPeer->second->sendPushMode(_itPushPeer->second->pushInMode | _currentPushMask);
+			modes[_itPushPeer->second.get()] |= _currentPushMask;
 		else
 			TRACE("GroupMedia ", id, " - Push In - No new peer available for mask ", Format<UInt8>("%.2x", _currentPushMask))
+
+		for (auto& itMode : modes) {
+			if (itMode.second != itMode.first->pushInMode)
+				itMode.first->sendPushMode(itMode.second);
+			itMode.first->resetPushCounts();
+		}
+		if (_pushInCount)
+			DEBUG("GroupMedia ", id, " - Push In - ", _pushInCount, " fragments received, ", _pushInDuplicates, " duplicates (", _pushInDuplicates * 100 / _pushInCount, "%)")
 	}
 
 	_lastPushUpdate.update();
@@ -519,9 +577,9 @@ void GroupMedia::sendPullRequests() {
 		_itPullPeer = _mapPeers.begin();
 		if (RTMFP::getRandomIt<MAP_PEERS_INFO_TYPE, MAP_PEERS_INFO_ITERATOR_TYPE>(_mapPeers, itRandom1, [this](const MAP_PEERS_INFO_ITERATOR_TYPE& it) { return it->second->hasFragment(_currentPullFragment); })) {
 			TRACE("GroupMedia ", id, " - sendPullRequests - first fragment found : ", _currentPullFragment)
-			if (_fragments.find(_currentPullFragment) == _fragments.end()) { // ignoring if already received
+			if (!_fragments.has(_currentPullFragment)) { // ignoring if already received
 				itRandom1->second->sendPull(_currentPullFragment);
-				_mapWaitingFragments.emplace(piecewise_construct, forward_as_tuple(_currentPullFragment), forward_as_tuple(itRandom1->first.c_str()));
+				addPullRequest(_currentPullFragment, itRandom1);
 			}
 			else
 				_firstPullReceived = true;
@@ -529,9 +587,9 @@ void GroupMedia::sendPullRequests() {
 			TRACE("GroupMedia ", id, " - sendPullRequests - Unable to find the first fragment (", _currentPullFragment, ")")
 		if (RTMFP::getRandomIt<MAP_PEERS_INFO_TYPE, MAP_PEERS_INFO_ITERATOR_TYPE>(_mapPeers, _itPullPeer, [this](const MAP_PEERS_INFO_ITERATOR_TYPE& it) { return it->second->hasFragment(_currentPullFragment + 1); })) {
 			TRACE("GroupMedia ", id, " - sendPullRequests - second fragment found : ", _currentPullFragment + 1)
-			if (_fragments.find(++_currentPullFragment) == _fragments.end()) { // ignoring if already received
+			if (!_fragments.has(++_currentPullFragment)) { // ignoring if already received
 				_itPullPeer->second->sendPull(_currentPullFragment);
-				_mapWaitingFragments.emplace(piecewise_construct, forward_as_tuple(_currentPullFragment), forward_as_tuple(_itPullPeer->first.c_str()));
+				addPullRequest(_currentPullFragment, _itPullPeer);
 			}
 			else
 				_firstPullReceived = true;
@@ -542,54 +600,161 @@ void GroupMedia::sendPullRequests() {
 		return;
 	}
 
-	// Loop on older fragments to send back the requests
-	timeMax -= groupParameters->fetchPeriod;
-	maxFragment = _mapPullTime2Fragment.lower_bound(timeMax);
-	if (maxFragment != _mapPullTime2Fragment.begin() && maxFragment != _mapPullTime2Fragment.end()) {
-		UInt64 lastOldFragment = (--maxFragment)->second; // get the first fragment < the fetch period * 2
-		for (auto itPull = _mapWaitingFragments.begin(); itPull != _mapWaitingFragments.end() && itPull->first <= lastOldFragment; itPull++) {
-
-			// Fetch period elapsed? => blacklist the peer and send back the request to another peer
-			if (itPull->second.time.isElapsed(groupParameters->fetchPeriod)) {
-
-				DEBUG("GroupMedia ", id, " - sendPullRequests - ", groupParameters->fetchPeriod, "ms without receiving fragment ", itPull->first, ", blacklisting peer ", itPull->second.peerId)
-				auto itPeer = _mapPeers.find(itPull->second.peerId);
-				if (itPeer != _mapPeers.end())
-					itPeer->second->addPullBlacklist(itPull->first);
-				
-				if (sendPullToNextPeer(itPull->first)) {
-					itPull->second.peerId = _itPullPeer->first.c_str();
-					itPull->second.time.update();
-				}
+	// Send back the requests which have timed out (3 x RTT of the peer)
+	for (UInt64 idPull = _waitingFragments.firstId(); !_waitingFragments.empty() && idPull <= _waitingFragments.lastId(); ++idPull) {
+		if (!(idPull & 63) && !_waitingFragments.word(idPull)) {
+			idPull |= 63;
+			continue; // no request in these 64 fragments
+		}
+		PullRequest* pPull = _waitingFragments.find(idPull);
+		if (!pPull || !pPull->time.isElapsed(pPull->timeout))
+			continue;
+
+		// Timeout elapsed? => blacklist the peer and send back the request to another peer
+		if (!pPull->peerId.empty()) {
+			DEBUG("GroupMedia ", id, " - sendPullRequests - ", pPull->timeout, "ms without receiving fragment ", idPull, ", blacklisting peer ", pPull->peerId.toString())
+			auto itPeer = _mapPeers.find(pPull->peerId);
+			if (itPeer != _mapPeers.end()) {
+				itPeer->second->addPullBlacklist(idPull);
+				itPeer->second->endPull(PeerMedia::PULL_TIMEOUT);
 			}
+			pPull->peerId.clear();
 		}
+		sendPullToBestPeer(idPull);
 	}
 
-	// Find the holes and send pull requests
-	for (; _currentPullFragment < lastFragment; _currentPullFragment++) {
+	// Find the holes (64 fragments at a time) and send pull requests, rarest fragments first
+	while (_currentPullFragment < lastFragment) {
+		UInt64 index = _currentPullFragment + 1, base = index & ~63ULL;
+		UInt64 holes = ~_fragments.word(index) & (~0ULL << (index & 63));
+		if ((lastFragment >> 6) == (index >> 6))
+			holes &= ~0ULL >> (63 - (lastFragment & 63));
+		for (UInt8 bit = (UInt8)(index & 63); bit < 64; ++bit) {
+			if ((holes & (1ULL << bit)) && _waitingFragments.has(base + bit))
+				holes &= ~(1ULL << bit); // already requested
+		}
+
+		// Count the holders of each hole
+		UInt8 holders[64] = { 0 };
+		UInt64 available = 0;
+		if (holes) {
+			for (auto& itPeer : _mapPeers) {
+				UInt64 fragments = itPeer.second->fragmentsAvailable(index) & holes;
+				available |= fragments;
+				for (UInt8 bit = 0; fragments; ++bit, fragments >>= 1) {
+					if ((fragments & 1) && holders[bit] < 0xFF)
+						++holders[bit];
+				}
+			}
+		}
+		vector<UInt8> order;
+		for (UInt8 bit = 0; bit < 64; ++bit) {
+			if (available & (1ULL << bit))
+				order.emplace_back(bit);
+		}
+		stable_sort(order.begin(), order.end(), [&holders](UInt8 bit1, UInt8 bit2) { return holders[bit1] < holders[bit2]; });
+
+		for (UInt8 bit : order) {
+			if (_waitingFragments.size() >= NETGROUP_PULL_WINDOW)
+				break; // pull window is full
+			if (sendPullToBestPeer(base + bit))
+				holes &= ~(1ULL << bit);
+		}
 
-		if (_fragments.find(_currentPullFragment + 1) == _fragments.end() && !sendPullToNextPeer(_currentPullFragment + 1))
-			break; // we wait for the fragment to be available
+		// Wait for the first hole not requested to be available
+		if (holes) {
+			UInt8 bit = 0;
+			while (!(holes & (1ULL << bit)))
+				++bit;
+			if (!(available & (1ULL << bit)))
+				DEBUG("GroupMedia ", id, " - sendPullRequests - No peer found for fragment ", base + bit)
+			_currentPullFragment = base + bit - 1;
+			break;
+		}
+		_currentPullFragment = min(base + 63, lastFragment);
 	}
 
-	TRACE("GroupMedia ", id, " - sendPullRequests - Pull requests done : ", _mapWaitingFragments.size(), " waiting fragments (current : ", _currentPullFragment, "; last Fragment : ", lastFragment, ")")
+	TRACE("GroupMedia ", id, " - sendPullRequests - Pull requests done : ", _waitingFragments.size(), " waiting fragments (current : ", _currentPullFragment, "; last Fragment : ", lastFragment, ")")
 }
 
-bool GroupMedia::sendPullToNextPeer(UInt64 idFragment) {
-
-	if (!getNextPeer(_itPullPeer, true, idFragment, 0)) {
-		DEBUG("GroupMedia ", id, " - sendPullRequests - No peer found for fragment ", idFragment)
+bool GroupMedia::sendPullToBestPeer(UInt64 idFragment) {
+
+	auto itBest = _mapPeers.end();
+	double bestScore(0);
+	for (auto itPeer = _mapPeers.begin(); itPeer != _mapPeers.end(); ++itPeer) {
+		if (itPeer->second->pullsInFlight >= NETGROUP_MAX_PEER_PULLS || !itPeer->second->hasFragment(idFragment))
+			continue;
+		double score = itPeer->second->pullScore();
+		if (itBest == _mapPeers.end() || score < bestScore) {
+			itBest = itPeer;
+			bestScore = score;
+		}
+	}
+	if (itBest == _mapPeers.end()) {
+		TRACE("GroupMedia ", id, " - sendPullRequests - No peer available for fragment ", idFragment)
 		return false;
 	}
 	
-	_itPullPeer->second->sendPull(idFragment);
-	_mapWaitingFragments.emplace(piecewise_construct, forward_as_tuple(idFragment), forward_as_tuple(_itPullPeer->first.c_str()));
+	itBest->second->sendPull(idFragment);
+	PullRequest* pPull = _waitingFragments.find(idFragment);
+	if (!pPull)
+		addPullRequest(idFragment, itBest);
+	else {
+		pPull->peerId = itBest->first;
+		pPull->timeout = pullTimeout(*itBest->second);
+		pPull->time.update();
+	}
 	return true;
 }
 
+void GroupMedia::addPullRequest(UInt64 idFragment, MAP_PEERS_INFO_ITERATOR_TYPE itPeer) {
+	if (!_waitingFragments.empty() && idFragment >= _waitingFragments.firstId() + FRAGMENT_RING_MAX_SIZE)
+		cancelPullRequests(idFragment - FRAGMENT_RING_MAX_SIZE + 1); // the ring would evict them without ending the pulls
+	_waitingFragments.emplace(idFragment, itPeer->first, pullTimeout(*itPeer->second));
+}
+
+void GroupMedia::cancelPullRequests(UInt64 idFragment) {
+	if (_waitingFragments.empty() || _waitingFragments.firstId() >= idFragment)
+		return;
+
+	WARN("GroupMedia ", id, " - Deletion of waiting fragments ", _waitingFragments.firstId(), " to ", min(_waitingFragments.lastId(), idFragment - 1))
+	for (UInt64 idPull = _waitingFragments.firstId(); idPull < idFragment && idPull <= _waitingFragments.lastId(); ++idPull) {
+		PullRequest* pPull = _waitingFragments.find(idPull);
+		if (!pPull)
+			continue;
+		auto itPeer = _mapPeers.find(pPull->peerId);
+		if (itPeer != _mapPeers.end())
+			itPeer->second->endPull(PeerMedia::PULL_CANCELLED);
+	}
+	_waitingFragments.eraseBefore(idFragment);
+}
+
+bool GroupMedia::isFragmentTooFar(UInt64 idFragment) {
+	UInt64 lastId = max(_lastFragmentMapId, _fragments.empty() ? 0 : _fragments.lastId());
+	return lastId && idFragment > lastId + GROUPMEDIA_MAX_FRAGMENTS_GAP;
+}
+
+UInt32 GroupMedia::pullTimeout(PeerMedia& peer) {
+	UInt32 timeout = peer.latency() * 6; // 3 x RTT
+	if (timeout < NETGROUP_PULL_TIMEOUT_MIN)
+		timeout = NETGROUP_PULL_TIMEOUT_MIN;
+	return (timeout < groupParameters->fetchPeriod) ? timeout : groupParameters->fetchPeriod;
+}
+
+void GroupMedia::addPullTime(UInt32 time) {
+	_pullTimes.emplace_back(time);
+	if (_pullTimes.size() < GROUPMEDIA_PULL_STATS_COUNT)
+		return;
+
+	sort(_pullTimes.begin(), _pullTimes.end());
+	DEBUG("GroupMedia ", id, " - Pull time-to-fill : p50=", _pullTimes[_pullTimes.size() / 2], "ms ; p90=", _pullTimes[_pullTimes.size() * 9 / 10], "ms ; p99=", 
+		_pullTimes[_pullTimes.size() * 99 / 100], "ms ; max=", _pullTimes.back(), "ms")
+	_pullTimes.clear();
+}
+
 void GroupMedia::removePeer(const string& peerId) {
 	
-	auto itPeer = _mapPeers.find(peerId);
+	auto itPeer = _mapPeers.find(PeerId(peerId));
 	if (itPeer != _mapPeers.end())
 		removePeer(itPeer);
 	else
@@ -598,7 +763,7 @@ void GroupMedia::removePeer(const string& peerId) {
 
 void GroupMedia::removePeer(MAP_PEERS_INFO_ITERATOR_TYPE itPeer) {
 
-	DEBUG("GroupMedia ", id, " - Removing peer ", itPeer->first, " (", _mapPeers.size()," peers)")
+	DEBUG("GroupMedia ", id, " - Removing peer ", itPeer->first.toString(), " (", _mapPeers.size()," peers)")
 	itPeer->second->OnPeerClose::unsubscribe(onPeerClose);
 	itPeer->second->OnPlayPull::unsubscribe(onPlayPull);
 	itPeer->second->OnFragmentsMap::unsubscribe(onFragmentsMap);
@@ -627,7 +792,7 @@ void GroupMedia::callFunction(const char* function, int nbArgs, const char** arg
 			writer.writeString(args[i], strlen(args[i]));
 	}
 
-	UInt32 currentTime = (_fragments.empty())? 0 : _fragments.rbegin()->second.time;
+	UInt32 currentTime = (_fragments.empty())? 0 : _fragments.last().time;
 
 	// Create and send the fragment
 	TRACE("Creating fragment for function ", function, "...")
@@ -37,6 +37,7 @@ GroupStream::~GroupStream() {
 bool GroupStream::process(PacketReader& packet, UInt64 flowId, UInt64 writerId, double lostRate) {
 
 	UInt32 time(0);
+	PacketReader message(packet.current(), packet.available()); // whole message, media fragments are stored and relayed as is
 	GroupStream::ContentType type = (GroupStream::ContentType)packet.read8();
 
 	// if exception, it closes the connection, and print an ERROR message
@@ -109,7 +110,8 @@ bool GroupStream::process(PacketReader& packet, UInt64 flowId, UInt64 writerId,
 			UInt8 mediaType = packet.read8();
 			time = packet.read32();
 			DEBUG("GroupStream ", id, " - Group media normal : counter=", counter, ", time=", time, ", type=", (mediaType == AMF::AUDIO ? "Audio" : (mediaType == AMF::VIDEO ? "Video" : "Unknown")))
-			OnFragment::raise(type, counter, 0, mediaType, time, packet, lostRate, id, flowId, writerId);
+			message.next(message.available() - packet.available()); // go to the payload
+			OnFragment::raise(type, counter, 0, mediaType, time, message, lostRate, id, flowId, writerId);
 			if (mediaType != AMF::AUDIO && mediaType != AMF::VIDEO)
 				return FlashStream::process((AMF::ContentType)mediaType, time, packet, id, writerId, lostRate); // recursive call, can be invocation, data etc.. (TODO: manage fragmented data)
 			return true;
@@ -123,8 +125,10 @@ bool GroupStream::process(PacketReader& packet, UInt64 flowId, UInt64 writerId,
 			time = packet.read32();
 
 			DEBUG("GroupStream ", id, " - Group media start : counter=", counter, ", time=", time, ", splitNumber=", splitNumber, ", type=", (mediaType == AMF::AUDIO ? "Audio" : (mediaType == AMF::VIDEO ? "Video" : "Unknown")))
-			if (mediaType == AMF::AUDIO || mediaType == AMF::VIDEO)
-				OnFragment::raise(type, counter, splitNumber, mediaType, time, packet, lostRate, id, flowId, writerId);
+			if (mediaType == AMF::AUDIO || mediaType == AMF::VIDEO) {
+				message.next(message.available() - packet.available()); // go to the payload
+				OnFragment::raise(type, counter, splitNumber, mediaType, time, message, lostRate, id, flowId, writerId);
+			}
 			else // TODO: Support other types (functions) with splitted fragments
 				ERROR("Media type ", Format<UInt8>("%02X", mediaType), " not supported (or data decoding error)")
 			return true;
@@ -134,14 +138,16 @@ bool GroupStream::process(PacketReader& packet, UInt64 flowId, UInt64 writerId,
 			UInt64 counter = packet.read7BitLongValue();
 			UInt8 splitNumber = packet.read8(); // counter of the splitted sequence
 			DEBUG("GroupStream ", id, " - Group media next : counter=", counter, ", splitNumber=", splitNumber)
-			OnFragment::raise(type, counter, splitNumber, 0, 0, packet, lostRate, id, flowId, writerId);
+			message.next(message.available() - packet.available()); // go to the payload
+			OnFragment::raise(type, counter, splitNumber, 0, 0, message, lostRate, id, flowId, writerId);
 			return true;
 		}
 		case GroupStream::GROUP_MEDIA_END: { // End of a splitted media sequence
 
 			UInt64 counter = packet.read7BitLongValue();
 			DEBUG("GroupStream ", id, " - Group media end : counter=", counter)
-			OnFragment::raise(type, counter, 0, 0, 0, packet, lostRate, id, flowId, writerId);
+			message.next(message.available() - packet.available()); // go to the payload
+			OnFragment::raise(type, counter, 0, 0, 0, message, lostRate, id, flowId, writerId);
 			return true;
 		}
 
@@ -33,14 +33,22 @@ ConnectionsManager::ConnectionsManager(Invoker& invoker):_invoker(invoker),Task(
 void ConnectionsManager::run(Exception& ex) {
 	do {
 		waitHandle();
-	} while (sleep(DELAY_CONNECTIONS_MANAGER) != STOP);
+	} while (sleep(DELAY_CONNECTIONS_MANAGER - (UInt32)min<Int64>(_lastManage.elapsed(), DELAY_CONNECTIONS_MANAGER - 1)) != STOP);
 }
 
-void ConnectionsManager::handle(Exception& ex) { _invoker.manage(); }
+void ConnectionsManager::handle(Exception& ex) {
+	_invoker.flushPublications();
+
+	// Can be woken up before the delay by an asynchronous publication
+	if (_lastManage.isElapsed(DELAY_CONNECTIONS_MANAGER)) {
+		_lastManage.update();
+		_invoker.manage();
+	}
+}
 
 /** Invoker **/
 
-Invoker::Invoker(UInt16 threads) : Startable("Invoker"), poolThreads(threads), sockets(*this, poolBuffers, poolThreads), _manager(*this), _lastIndex(0), _init(false) {
+Invoker::Invoker(UInt16 threads) : Startable("Invoker"), poolThreads(threads), sockets(*this, poolBuffers, poolThreads), _manager(*this), _lastIndex(0), _init(false), _flushRequested(false) {
 	_globalLogger.reset(new RTMFPLogger());
 	Logs::SetLogger(*_globalLogger);
 }
@@ -112,6 +120,20 @@ unsigned int Invoker::empty() {
 	return _mapConnections.empty();
 }
 
+void Invoker::requestFlushPublications() {
+	if (!_flushRequested.exchange(true))
+		_manager.requestFlush();
+}
+
+void Invoker::flushPublications() {
+	if (!_flushRequested.exchange(false))
+		return;
+
+	lock_guard<recursive_mutex>	lock(_mutexConnections);
+	for (auto& it : _mapConnections)
+		it.second->flushPublication();
+}
+
 void Invoker::manage() {
 	lock_guard<recursive_mutex>	lock(_mutexConnections);
 	auto it = _mapConnections.begin();
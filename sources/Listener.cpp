@@ -27,18 +27,21 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 using namespace Mona;
 
-Listener::Listener(Publisher& publication, const string& identifier) : publication(publication), identifier(identifier),
+Listener::Listener(Publisher& publication, const string& identifier) : publication(publication), identifier(identifier), pThread(NULL), replaying(false),
 	_publicationNamePacket((const UInt8*)publication.name().c_str(), publication.name().size()) {
 
 }
 
 FlashListener::FlashListener(Publisher& publication, const string& identifier, FlashWriter* pDataWriter, FlashWriter* pAudioWriter, FlashWriter* pVideoWriter) : Listener(publication, identifier),
 	_pDataWriter(pDataWriter), _pAudioWriter(pAudioWriter), _pVideoWriter(pVideoWriter), receiveAudio(true), receiveVideo(true), _firstTime(true), _seekTime(0),
-	_dataInitialized(false), _reliable(true), _startTime(0), _lastTime(0), _codecInfosSent(false) {
+	_dataInitialized(false), _reliable(true), _videoReliable(publication.videoReliable()), _startTime(0), _lastTime(0), _codecInfosSent(false),
+	_waitKeyFrame(false), _droppedFrames(0) {
 
 }
 
 FlashListener::~FlashListener() {
+	if (_droppedFrames)
+		INFO(_droppedFrames, " video frames dropped for one FlashListener of ", publication.name(), " publication")
 	closeWriters();
 }
 
@@ -52,6 +55,8 @@ void FlashListener::closeWriters() {
 		_pVideoWriter->close(false);
 	_pDataWriter = _pVideoWriter = _pAudioWriter = NULL;
 	_dataInitialized = false;
+	_videoSent.clear();
+	_waitKeyFrame = false;
 }
 
 bool FlashListener::initWriters() {
@@ -112,16 +117,16 @@ void FlashListener::stopPublishing() {
 }
 
 
-void FlashListener::pushVideo(UInt32 time, const Mona::UInt8* data, Mona::UInt32 size) {
+void FlashListener::pushVideo(UInt32 time, const Mona::UInt8* data, Mona::UInt32 size, bool keyFrame) {
 	if (!receiveVideo && !RTMFP::IsH264CodecInfos(data,size))
 		return;
 
 	if (!_codecInfosSent) {
-		if (RTMFP::IsKeyFrame(data, size)) {
+		if (keyFrame) {
 			_codecInfosSent = true;
 			if (!publication.videoCodecBuffer().empty() && !RTMFP::IsH264CodecInfos(data, size)) {
 				INFO("H264 codec infos sent to one FlashListener of ", publication.name(), " publication")
-				pushVideo(time, publication.videoCodecBuffer()->data(), publication.videoCodecBuffer()->size());
+				pushVideo(time, publication.videoCodecBuffer()->data(), publication.videoCodecBuffer()->size(), true);
 			}
 		}
 		else {
@@ -145,8 +150,48 @@ void FlashListener::pushVideo(UInt32 time, const Mona::UInt8* data, Mona::UInt32
 
 	//TRACE("Video time(+seekTime) => ", time, "(+", _seekTime, "), size : ", size);
 
-	if (!writeMedia(*_pVideoWriter, RTMFP::IsKeyFrame(data, size) || _reliable, FlashWriter::VIDEO, _lastTime = (time + _seekTime), data, size))
+	time += _seekTime;
+	if (!_videoReliable && dropVideo(time, data, size, keyFrame))
+		return;
+
+	if (!writeMedia(*_pVideoWriter, keyFrame || _videoReliable, FlashWriter::VIDEO, _lastTime = time, data, size))
 		initWriters();
+	else if (!_videoReliable)
+		_videoSent.emplace_back(time, _pVideoWriter->stage());
+}
+
+UInt32 FlashListener::videoDelay(UInt32 time) {
+	UInt64 stageAck = _pVideoWriter->stageAck();
+	while (!_videoSent.empty() && _videoSent.front().second <= stageAck)
+		_videoSent.pop_front();
+	return _videoSent.empty() ? 0 : time - _videoSent.front().first;
+}
+
+bool FlashListener::dropVideo(UInt32 time, const UInt8* data, UInt32 size, bool keyFrame) {
+	if (RTMFP::IsH264CodecInfos(data, size))
+		return false;
+
+	UInt32 delay = videoDelay(time);
+	if (_waitKeyFrame) {
+		if (!keyFrame) {
+			++_droppedFrames;
+			return true;
+		}
+		DEBUG("Key frame received, video restarted for one FlashListener of ", publication.name(), " (delay : ", delay, "ms)")
+		_waitKeyFrame = false;
+		return false;
+	}
+	if (keyFrame || delay <= FLASHLISTENER_DROP_DELAY)
+		return false;
+
+	if (delay > FLASHLISTENER_DROP_GOP_DELAY) {
+		DEBUG("Video delay of ", delay, "ms for one FlashListener of ", publication.name(), ", waiting for the next key frame")
+		_waitKeyFrame = true;
+	}
+	else if (!RTMFP::IsDisposableFrame(data, size))
+		return false;
+	++_droppedFrames;
+	return true;
 }
 
 
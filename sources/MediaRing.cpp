@@ -0,0 +1,154 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MediaRing.h"
+#include "RTMFP.h"
+#include "Mona/BinaryWriter.h"
+
+using namespace Mona;
+using namespace std;
+
+static UInt32 RingCapacity(UInt32 capacity) {
+	UInt32 result = 0x400; // minimum 1KB
+	while (result < capacity && result < 0x80000000)
+		result <<= 1;
+	return result;
+}
+
+MediaRing::MediaRing(UInt32 capacity) : _buffer(RingCapacity(capacity)), _head(0), _tail(0), _overflows(0), _headTime(0), _tailTime(0), _readPos(0) {
+	_mask = _buffer.size() - 1;
+}
+
+bool MediaRing::writeTag(UInt8 type, UInt32 time, const UInt8* data, UInt32 size, UInt8 flags) {
+	MediaSpan span(data, size);
+	return writeTag(type, time, &span, 1, size, flags);
+}
+
+bool MediaRing::writeTag(UInt8 type, UInt32 time, const MediaSpan* spans, UInt32 count, UInt32 size, UInt8 flags) {
+	UInt32 tagSize = size + 15, recordSize = RecordSize(tagSize);
+	UInt64 head = _head.load(memory_order_relaxed), tail = _tail.load(memory_order_acquire);
+	UInt32 offset = (UInt32)(head & _mask), toEnd = _buffer.size() - offset;
+
+	// A record is never splitted, we add a padding record if it doesn't fit before the end
+	UInt32 needed = (recordSize > toEnd) ? toEnd + recordSize : recordSize;
+	if (recordSize > _buffer.size() || needed > _buffer.size() - (head - tail)) {
+		_overflows.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+	if (recordSize > toEnd) {
+		UInt32 padding(MEDIA_RING_PADDING);
+		memcpy(_buffer.data() + offset, &padding, 4); // toEnd is always >= 4 (records are aligned)
+		head += toEnd;
+		offset = 0;
+	}
+
+	UInt8* record = _buffer.data() + offset;
+	memcpy(record, &tagSize, 4);
+	BinaryWriter writer(record + 4, tagSize);
+	writer.write8(type);
+	// size on 3 bytes
+	writer.write24(size);
+	// time on 3 bytes + extended time
+	writer.write24(time);
+	writer.write8(time >> 24);
+	// stream id set to 0 (except internal flags)
+	writer.write24(flags);
+	// payload
+	for (UInt32 i = 0; i < count; ++i)
+		writer.write(spans[i].data, spans[i].size);
+	// footer
+	writer.write32(11 + size);
+
+	_headTime.store(time, memory_order_relaxed);
+	_head.store(head + recordSize, memory_order_release);
+	return true;
+}
+
+const UInt8* MediaRing::next(UInt64& record, UInt32& size) {
+	UInt64 tail = _tail.load(memory_order_relaxed), head = _head.load(memory_order_acquire);
+	while (tail != head) {
+		UInt32 offset = (UInt32)(tail & _mask);
+		memcpy(&size, _buffer.data() + offset, 4);
+		if (size != MEDIA_RING_PADDING) {
+			record = tail;
+			return _buffer.data() + offset + 4;
+		}
+		// Padding : go to the beginning of the ring
+		tail += _buffer.size() - offset;
+		_tail.store(tail, memory_order_release);
+	}
+	return NULL;
+}
+
+UInt32 MediaRing::read(UInt8* buf, UInt32 size) {
+	UInt32 nbRead = 0, tagSize = 0;
+	UInt64 record = 0;
+	const UInt8* tag = NULL;
+	while (nbRead < size && (tag = next(record, tagSize))) {
+		UInt32 toRead = tagSize - _readPos;
+		if (toRead > size - nbRead)
+			toRead = size - nbRead;
+		memcpy(buf + nbRead, tag + _readPos, toRead);
+		nbRead += toRead;
+
+		// If tag too big : save position and exit
+		if ((_readPos += toRead) < tagSize)
+			break;
+		consume(record, tag, tagSize);
+	}
+	return nbRead;
+}
+
+const UInt8* MediaRing::peek(UInt32& size) {
+	UInt64 record = 0;
+	return next(record, size);
+}
+
+void MediaRing::release() {
+	UInt32 tagSize = 0;
+	UInt64 record = 0;
+	const UInt8* tag = next(record, tagSize);
+	if (tag)
+		consume(record, tag, tagSize);
+}
+
+bool MediaRing::skip(UInt64 position) {
+	if (_readPos)
+		return false; // the reader must finish the current tag first
+	if (position > _tail.load(memory_order_relaxed)) {
+		_tailTime.store(_headTime.load(memory_order_relaxed), memory_order_relaxed); // approximation until the next tag is read
+		_tail.store(position, memory_order_release);
+	}
+	return true;
+}
+
+UInt32 MediaRing::duration() const {
+	if (empty())
+		return 0;
+	UInt32 headTime = _headTime.load(memory_order_relaxed), tailTime = _tailTime.load(memory_order_relaxed);
+	return (headTime > tailTime) ? headTime - tailTime : 0; // audio & video times can be slightly disordered
+}
+
+void MediaRing::consume(UInt64 record, const UInt8* tag, UInt32 size) {
+	_readPos = 0; // the tag is entirely consumed
+	_tailTime.store((tag[7] << 24) | (tag[4] << 16) | (tag[5] << 8) | tag[6], memory_order_relaxed); // time on 3 bytes after type & size + extended time
+	_tail.store(record + RecordSize(size), memory_order_release);
+}
@@ -23,83 +23,79 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "P2PSession.h"
 #include "GroupStream.h"
 #include "librtmfp.h"
+#include <algorithm>
 
 using namespace Mona;
 using namespace std;
 
-#if defined(_WIN32)
-	#define sscanf sscanf_s
-#endif
-
 // Peer instance in the heard list
+// The addresses are only needed to write Group Reports and to connect to the peer, so they are kept serialized :
+// the Group Report entry (addresses size, 0A, host and public addresses, next marker) followed by the local addresses
+// The addresses size is written on 1 byte, the public addresses which do not fit are saved with the local addresses (not reported)
 class GroupNode : public virtual Object {
 public:
-	GroupNode(const char* rawPeerId, const string& groupId, const PEER_LIST_ADDRESS_TYPE& listAddresses, const SocketAddress& host, UInt64 timeElapsed) :
-		rawId(rawPeerId, PEER_ID_SIZE + 2), groupAddress(groupId), addresses(listAddresses), hostAddress(host), lastGroupReport(((UInt64)Time::Now()) - timeElapsed) {}
-
-	// Return the size of peer addresses for Group Report 
-	UInt32	addressesSize() {
-		UInt32 size = hostAddress.host().size() + 4; // +4 for 0A, address type and port
-		for (auto itAddress : addresses)
-			if (itAddress.second != RTMFP::ADDRESS_LOCAL)
-				size += itAddress.first.host().size() + 3; // +3 for address type and port
-		return size;
+	GroupNode(const char* rawPeerId, const UInt8* groupId, const PEER_LIST_ADDRESS_TYPE& listAddresses, const SocketAddress& host, UInt64 timeElapsed) :
+		lastGroupReport(((UInt64)Time::Now()) - timeElapsed) {
+		memcpy(rawId, rawPeerId, PEER_ID_SIZE + 2);
+		memcpy(groupAddress, groupId, GROUP_ADDRESS_SIZE);
+
+		vector<PEER_LIST_ADDRESS_TYPE::const_iterator> reported, others;
+		UInt32 reportSize = host.host().size() + 4, othersSize = 0; // +4 for 0A, address type and port
+		for (auto itAddress = listAddresses.begin(); itAddress != listAddresses.end(); ++itAddress) {
+			UInt32 size = itAddress->first.host().size() + 3; // +3 for address type and port
+			if (itAddress->second != RTMFP::ADDRESS_LOCAL && reportSize + size <= 0xFF) {
+				reportSize += size;
+				reported.emplace_back(itAddress);
+			}
+			else {
+				othersSize += size;
+				others.emplace_back(itAddress);
+			}
+		}
+		_reportSize = reportSize + 2;
+		_addresses.resize(_reportSize + othersSize);
+
+		BinaryWriter writer(BIN _addresses.data(), _addresses.size());
+		writer.write8(reportSize);
+		writer.write8(0x0A);
+		RTMFP::WriteAddress(writer, host, RTMFP::ADDRESS_REDIRECTION);
+		for (auto& itAddress : reported)
+			RTMFP::WriteAddress(writer, itAddress->first, itAddress->second);
+		writer.write8(0); // marker of the next entry
+		for (auto& itAddress : others)
+			RTMFP::WriteAddress(writer, itAddress->first, itAddress->second);
+	}
+
+	// Group Report entry from the addresses size to the next marker
+	const UInt8*	reportEntry() const { return BIN _addresses.data(); }
+	UInt32			reportEntrySize() const { return _reportSize; }
+
+	// Read the addresses of the peer
+	void			readAddresses(PEER_LIST_ADDRESS_TYPE& addresses, SocketAddress& hostAddress) const {
+		BinaryReader reportReader(reportEntry() + 2, reportEntrySize() - 3); // without size, 0A and next marker
+		RTMFP::ReadAddresses(reportReader, addresses, hostAddress);
+		BinaryReader localReader(reportEntry() + reportEntrySize(), _addresses.size() - reportEntrySize());
+		RTMFP::ReadAddresses(localReader, addresses, hostAddress);
 	}
 
-	string rawId;
-	string groupAddress;
-	PEER_LIST_ADDRESS_TYPE addresses;
-	SocketAddress hostAddress;
-	UInt64 lastGroupReport; // Time in msec of last Group report received
+	UInt8			rawId[PEER_ID_SIZE + 2];
+	UInt8			groupAddress[GROUP_ADDRESS_SIZE];
+	UInt64			lastGroupReport; // Time in msec of last Group report received
+private:
+	string			_addresses;
+	UInt16			_reportSize; // Size of the Group Report entry at the beginning of _addresses
 };
 
-const string& NetGroup::GetGroupAddressFromPeerId(const char* rawId, std::string& groupAddress) {
+void NetGroup::GetGroupAddressFromPeerId(const char* rawId, UInt8* groupAddress) {
 	
-	static UInt8 tmp[PEER_ID_SIZE];
-	EVP_Digest(rawId, PEER_ID_SIZE+2, tmp, NULL, EVP_sha256(), NULL);
-	Util::FormatHex(tmp, PEER_ID_SIZE, groupAddress);
-	TRACE("Group address : ", groupAddress)
-	return groupAddress;
+	EVP_Digest(rawId, PEER_ID_SIZE+2, groupAddress, NULL, EVP_sha256(), NULL);
+	string tmp;
+	TRACE("Group address : ", Util::FormatHex(groupAddress, GROUP_ADDRESS_SIZE, tmp))
 }
 
 double NetGroup::estimatedPeersCount() {
 
-	if (_mapGroupAddress.size() < 4)
-		return _mapGroupAddress.size();
-
-	// First get the neighbors N-2 and N+2
-	auto itFirst = _mapGroupAddress.lower_bound(_myGroupAddress);
-	auto itLast = itFirst;
-	if (itFirst == _mapGroupAddress.end()) {
-		itFirst = --(--(_mapGroupAddress.end()));
-		itLast = ++(_mapGroupAddress.begin());
-	}
-	else {
-
-		if (itFirst->first > _myGroupAddress) {  // Current == N+1?
-			if (--itFirst == _mapGroupAddress.end())
-				itFirst = --(_mapGroupAddress.end());
-		} else if (++itLast == _mapGroupAddress.end())  // Current == N-1
-			itLast = _mapGroupAddress.begin();
-
-		if (--itFirst == _mapGroupAddress.end())
-			itFirst = --(_mapGroupAddress.end());
-		if (++itLast == _mapGroupAddress.end()) 
-			itLast = _mapGroupAddress.begin();
-	}
-	
-	TRACE("First peer (N-2) = ", itFirst->first)
-	TRACE("Last peer (N+2) = ", itLast->first)
-
-	UInt64 valFirst = 0, valLast = 0;
-	sscanf(itFirst->first.substr(0, 16).c_str(), "%llx", &valFirst);
-	sscanf(itLast->first.substr(0, 16).c_str(), "%llx", &valLast);
-
-	// Then calculate the total	
-	if (valLast > valFirst)
-		return (MAX_PEER_COUNT / (double(valLast - valFirst) / 4)) + 1;
-	else
-		return (MAX_PEER_COUNT / (double(valLast - valFirst + MAX_PEER_COUNT) / 4)) + 1;
+	return _groupAddresses.estimatedCount(_myGroupAddress);
 }
 
 UInt32 NetGroup::targetNeighborsCount() {
@@ -111,7 +107,7 @@ UInt32 NetGroup::targetNeighborsCount() {
 }
 
 NetGroup::NetGroup(const string& groupId, const string& groupTxt, const string& streamName, RTMFPSession& conn, RTMFPGroupConfig* parameters) : groupParameters(parameters),
-	idHex(groupId), idTxt(groupTxt), stream(streamName), _conn(conn), _pListener(NULL), _groupMediaPublisher(_mapGroupMedias.end()) {
+	idHex(groupId), idTxt(groupTxt), stream(streamName), _conn(conn), _myPeerId(conn.rawId() + 2), _pListener(NULL), _groupMediaPublisher(_mapGroupMedias.end()), _bestListVersion(0), _bestListObsolete(true) {
 	onNewMedia = [this](const string& peerId, shared_ptr<PeerMedia>& pPeerMedia, const string& streamName, const string& streamKey, PacketReader& packet) {
 
 		shared_ptr<RTMFPGroupConfig> pParameters(new RTMFPGroupConfig());
@@ -124,26 +120,28 @@ NetGroup::NetGroup(const string& groupId, const string& groupTxt, const string&
 			return false;
 		}*/
 
-		if (streamName != stream) {
+		// Search the stream in the registered streams (GroupMedia keeps a reference to the name)
+		const string* pStream = NULL;
+		{
+			lock_guard<mutex> lock(_mutexStreams);
+			auto itStream = _streams.find(streamName);
+			if (itStream != _streams.end())
+				pStream = &*itStream;
+		}
+		if (!pStream) {
+			// Keep the offer, the peer will not send it again if the stream is played later
 			INFO("New stream available in the group but not registered : ", streamName)
-			return false;
+			_pendingMedias[streamName].emplace_back(peerId, pPeerMedia, streamKey, pParameters);
+			return true;
 		}
 
-		// Create the Group Media if it does not exists
-		auto itGroupMedia = _mapGroupMedias.lower_bound(streamKey);
-		if (itGroupMedia == _mapGroupMedias.end() || itGroupMedia->first != streamKey) {
-			itGroupMedia = _mapGroupMedias.emplace_hint(itGroupMedia, piecewise_construct, forward_as_tuple(streamKey), forward_as_tuple(_conn.poolBuffers(), stream, streamKey, pParameters));
-			itGroupMedia->second.subscribe(onGroupPacket);
-			DEBUG("Creation of GroupMedia ", itGroupMedia->second.id," for the stream ", stream, " :\n", Util::FormatHex(BIN streamKey.data(), streamKey.size(), LOG_BUFFER))
-		}
-		
-		// And finally try to add the peer and send the GroupMedia subscription
-		itGroupMedia->second.addPeer(peerId, pPeerMedia);
+		addPeerMedia(peerId, pPeerMedia, *pStream, streamKey, pParameters);
 		return true;
 	};
 	onGroupReport = [this](P2PSession* pPeer, PacketReader& packet, bool sendMediaSubscription) {
 		
-		auto itNode = _mapHeardList.find(pPeer->peerId);
+		PeerId peerId(BIN pPeer->rawId.data() + 2);
+		auto itNode = _mapHeardList.find(peerId);
 		if (itNode != _mapHeardList.end())
 			itNode->second.lastGroupReport = Time::Now(); // Record the time of last Group Report received to build our Group Report
 
@@ -171,7 +169,7 @@ NetGroup::NetGroup(const string& groupId, const string& groupTxt, const string&
 			pPeer->groupReportInitiator = false;
 
 		// Send the Group Media Subscription if not already sent
-		if (sendMediaSubscription && (_bestList.empty() || _bestList.find(pPeer->peerId) != _bestList.end())) {
+		if (sendMediaSubscription && (bestList().empty() || _bestList.find(peerId) != _bestList.end())) {
 			for (auto& itGroupMedia : _mapGroupMedias) {
 				if (itGroupMedia.second.groupParameters->isPublisher || itGroupMedia.second.hasFragments()) {
 					auto pPeerMedia = pPeer->getPeerMedia(itGroupMedia.first);
@@ -183,27 +181,28 @@ NetGroup::NetGroup(const string& groupId, const string& groupTxt, const string&
 	onGroupBegin = [this](P2PSession* pPeer) {
 
 		 // When we receive the 0E NetGroup message type we must send the group report if not already sent
-		auto itNode = _mapHeardList.find(pPeer->peerId);
+		auto itNode = _mapHeardList.find(PeerId(BIN pPeer->rawId.data() + 2));
 		if (itNode == _mapHeardList.end() || pPeer->groupFirstReportSent)
 			return;
 
 		sendGroupReport(pPeer, true);
 		_lastReport.update();
 	};
-	onGroupPacket = [this](UInt32 time, const UInt8* data, UInt32 size, double lostRate, bool audio) {
-		_conn.pushMedia(stream, time, data, size, lostRate, audio);
+	onGroupPacket = [this](const string& streamName, UInt32 time, const MediaSpan* spans, UInt32 count, UInt32 size, double lostRate, bool audio) {
+		_conn.pushMedia(streamName, time, spans, count, size, lostRate, audio);
 	};
 	onPeerClose = [this](const string& peerId) {
 		removePeer(peerId);
 	};
 	onGroupAskClose = [this](const string& peerId) {
-		if (_bestList.empty())
+		if (bestList().empty())
 			return true; // do not disconnect peer if we have not calculated the best list (can it happen?)
 
-		return _bestList.find(peerId) != _bestList.end(); // if peer is not in the Best list return False tu close the main flow, otherwise keep connection open
+		return _bestList.find(PeerId(peerId)) != _bestList.end(); // if peer is not in the Best list return False tu close the main flow, otherwise keep connection open
 	};
 
 	GetGroupAddressFromPeerId(STR _conn.rawId(), _myGroupAddress);
+	_streams.emplace(stream);
 
 	// If Publisher create a new GroupMedia
 	if (groupParameters->isPublisher) {
@@ -249,32 +248,35 @@ void NetGroup::close() {
 
 void NetGroup::addPeer2HeardList(const string& peerId, const char* rawId, const PEER_LIST_ADDRESS_TYPE& listAddresses, const SocketAddress& hostAddress, UInt64 timeElapsed) {
 
-	auto it = _mapHeardList.lower_bound(peerId);
-	if (it != _mapHeardList.end() && it->first == peerId) {
+	PeerId id(BIN rawId + 2);
+	auto it = _mapHeardList.lower_bound(id);
+	if (it != _mapHeardList.end() && it->first == id) {
 		DEBUG("The peer ", peerId, " is already known")
 		return;
 	}
 
-	string groupAddress;
-	_mapGroupAddress.emplace(GetGroupAddressFromPeerId(rawId, groupAddress), peerId);
-	it = _mapHeardList.emplace_hint(it, piecewise_construct, forward_as_tuple(peerId.c_str()), forward_as_tuple(rawId, groupAddress, listAddresses, hostAddress, timeElapsed));
-	DEBUG("Peer ", it->first, " added to heard list")
+	UInt8 groupAddress[GROUP_ADDRESS_SIZE];
+	GetGroupAddressFromPeerId(rawId, groupAddress);
+	it = _mapHeardList.emplace_hint(it, piecewise_construct, forward_as_tuple(id), forward_as_tuple(rawId, groupAddress, listAddresses, hostAddress, timeElapsed));
+	_groupAddresses.add(groupAddress, it->first);
+	DEBUG("Peer ", peerId, " added to heard list")
 }
 
 bool NetGroup::addPeer(const string& peerId, shared_ptr<P2PSession> pPeer) {
 
-	if (_mapHeardList.find(peerId) == _mapHeardList.end()) {
+	PeerId id(peerId);
+	if (_mapHeardList.find(id) == _mapHeardList.end()) {
 		ERROR("Unknown peer to add : ", peerId)
 		return false;
 	}
 
-	auto it = _mapPeers.lower_bound(peerId);
-	if (it != _mapPeers.end() && it->first == peerId) {
+	auto it = _mapPeers.lower_bound(id);
+	if (it != _mapPeers.end() && it->first == id) {
 		ERROR("Unable to add the peer ", peerId, ", it already exists")
 		return false;
 	}
 	DEBUG("Adding the peer ", peerId, " to the Best List")
-	_mapPeers.emplace_hint(it, peerId, pPeer);
+	_mapPeers.emplace_hint(it, id, pPeer);
 
 	pPeer->OnNewMedia::subscribe(onNewMedia);
 	pPeer->OnPeerGroupReport::subscribe(onGroupReport);
@@ -282,13 +284,13 @@ bool NetGroup::addPeer(const string& peerId, shared_ptr<P2PSession> pPeer) {
 	pPeer->OnPeerClose::subscribe(onPeerClose);
 	pPeer->OnPeerGroupAskClose::subscribe(onGroupAskClose);
 
-	buildBestList(_myGroupAddress, _bestList); // rebuild the best list to know if the peer is in it
+	_bestListObsolete = true; // the best list will be calculated again when needed
 	return true;
 }
 
 void NetGroup::removePeer(const string& peerId) {
 
-	auto itPeer = _mapPeers.find(peerId);
+	auto itPeer = _mapPeers.find(PeerId(peerId));
 	if (itPeer == _mapPeers.end())
 		DEBUG("The peer ", peerId, " is already removed from the Best list")
 	else
@@ -296,26 +298,34 @@ void NetGroup::removePeer(const string& peerId) {
 }
 
 void NetGroup::removePeer(MAP_PEERS_ITERATOR_TYPE itPeer) {
-	DEBUG("Deleting peer ", itPeer->first, " from the NetGroup Best List")
+	DEBUG("Deleting peer ", itPeer->second->peerId, " from the NetGroup Best List")
 
 	itPeer->second->OnNewMedia::unsubscribe(onNewMedia);
 	itPeer->second->OnPeerGroupReport::unsubscribe(onGroupReport);
 	itPeer->second->OnPeerGroupBegin::unsubscribe(onGroupBegin);
 	itPeer->second->OnPeerClose::unsubscribe(onPeerClose);
 	itPeer->second->OnPeerGroupAskClose::unsubscribe(onGroupAskClose);
+	_mapTargetBestLists.erase(itPeer->first);
 	_mapPeers.erase(itPeer);
+	_bestListObsolete = true;
 }
 
 bool NetGroup::checkPeer(const string& peerId) {
 
-	return _mapPeers.find(peerId) == _mapPeers.end();
+	return _mapPeers.find(PeerId(peerId)) == _mapPeers.end();
 }
 
 void NetGroup::manage() {
 
-	// Manage the Best list
-	if (_lastBestCalculation.isElapsed(NETGROUP_BEST_LIST_DELAY))
+	// Accept the media of the streams added by the application
+	if (!_pendingMedias.empty())
+		acceptPendingMedias();
+
+	// Manage the Best list (calculated again to follow the latencies)
+	if (_lastBestCalculation.isElapsed(NETGROUP_BEST_LIST_DELAY)) {
+		_bestListObsolete = true;
 		updateBestList();
+	}
 
 	// Send the Group Report message (0A) to a random connected peer
 	if (_lastReport.isElapsed(NETGROUP_REPORT_DELAY)) {
@@ -329,12 +339,9 @@ void NetGroup::manage() {
 		auto itHeardList = _mapHeardList.begin();
 		while (itHeardList != _mapHeardList.end()) {
 			if ((_mapPeers.find(itHeardList->first) == _mapPeers.end()) && now > itHeardList->second.lastGroupReport && ((now - itHeardList->second.lastGroupReport) > NETGROUP_PEER_TIMEOUT)) {
-				DEBUG("Peer ", itHeardList->first, " timeout (", NETGROUP_PEER_TIMEOUT, "ms elapsed) - deleting from the heard list...")
-				auto itGroupAddress = _mapGroupAddress.find(itHeardList->second.groupAddress);
-				if (itGroupAddress == _mapGroupAddress.end())
-					WARN("Unable to find peer ", itHeardList->first, " in the map of Group Addresses") // should not happen
-				else
-					_mapGroupAddress.erase(itGroupAddress);
+				DEBUG("Peer ", itHeardList->first.toString(), " timeout (", NETGROUP_PEER_TIMEOUT, "ms elapsed) - deleting from the heard list...")
+				if (!_groupAddresses.erase(itHeardList->second.groupAddress))
+					WARN("Unable to find peer ", itHeardList->first.toString(), " in the ring of Group Addresses") // should not happen
 				_mapHeardList.erase(itHeardList++);
 				continue;
 			}
@@ -351,111 +358,110 @@ void NetGroup::manage() {
 
 void NetGroup::updateBestList() {
 
-	buildBestList(_myGroupAddress, _bestList);
+	bestList();
 	manageBestConnections();
 	_lastBestCalculation.update();
 }
 
-void NetGroup::buildBestList(const string& groupAddress, set<string>& bestList) {
+const set<PeerId>& NetGroup::bestList() {
+	if (_bestListObsolete || _bestListVersion != _groupAddresses.version()) {
+		buildBestList(_myGroupAddress, _bestList);
+		_bestListVersion = _groupAddresses.version();
+		_bestListObsolete = false;
+	}
+	return _bestList;
+}
+
+void NetGroup::buildBestList(const UInt8* groupAddress, set<PeerId>& bestList) {
 	bestList.clear();
+	UInt32 count = _groupAddresses.size();
 
 	// Find the 6 closest peers
-	if (_mapGroupAddress.size() <= 6) {
-		for (auto it : _mapGroupAddress)
-			bestList.emplace(it.second);
+	if (count <= 6) {
+		for (UInt32 i = 0; i < count; ++i)
+			bestList.emplace(_groupAddresses.peerId(i));
 	}
 	else { // More than 6 peers
 
-		// First we search the first of the 6 peers
-		map<string, string>::iterator itFirst = _mapGroupAddress.lower_bound(groupAddress);
-		if (itFirst == _mapGroupAddress.end())
-			itFirst = --(_mapGroupAddress.end());
-		for (int i = 0; i < 2; i++) {
-			if (--itFirst == _mapGroupAddress.end()) // if we reach the first peer we restart from the end
-				itFirst = --(_mapGroupAddress.end());
-		}
-
-		for (int j = 0; j < 6; j++) {
-			bestList.emplace(itFirst->second);
-
-			if (++itFirst == _mapGroupAddress.end()) // if we reach the end we restart from the beginning
-				itFirst = _mapGroupAddress.begin();
-		}
+		// First we search the first of the 6 peers (2 before the group address, around the ring)
+		UInt32 index = _groupAddresses.lowerBound(groupAddress);
+		index = _groupAddresses.move((index == count) ? count - 1 : index, -2);
+		for (int j = 0; j < 6; j++, index = _groupAddresses.move(index, 1))
+			bestList.emplace(_groupAddresses.peerId(index));
 	}
 
 	// Find the 6 lowest latency
-	if (_mapGroupAddress.size() > 6) {
-		deque<shared_ptr<P2PSession>> queueLatency;
-		if (!_mapPeers.empty()) {
-			for (auto it : _mapPeers) { // First, order the peers by latency
-				UInt16 latency = it.second->latency();
-				auto it2 = queueLatency.begin();
-				while (it2 != queueLatency.end() && (*it2)->latency() < latency)
-					++it2;
-				queueLatency.emplace(it2, it.second);
-			}
-			auto itLatency = queueLatency.begin();
-			int i = 0;
-			do {
-				if (bestList.emplace((*itLatency)->peerId).second)
-					i++;
-			} while (++itLatency != queueLatency.end() && i < 6);
+	if (count > 6) {
+		vector<MAP_PEERS_TYPE::value_type*> peers;
+		peers.reserve(_mapPeers.size());
+		for (auto& it : _mapPeers) {
+			if (bestList.find(it.first) == bestList.end())
+				peers.emplace_back(&it);
 		}
-
-		// Add one random peer
-		if (_mapGroupAddress.size() > bestList.size()) {
-
-			auto itRandom = _mapGroupAddress.begin();
-			if (RTMFP::getRandomIt<map<string, string>, map<string, string>::iterator>(_mapGroupAddress, itRandom, [bestList](const map<string, string>::iterator& it) { return bestList.find(it->second) != bestList.end(); }))
-				bestList.emplace(itRandom->second);
+		auto itLast = peers.begin() + min<size_t>(6, peers.size());
+		partial_sort(peers.begin(), itLast, peers.end(), [](MAP_PEERS_TYPE::value_type* pPeer1, MAP_PEERS_TYPE::value_type* pPeer2) { return pPeer1->second->latency() < pPeer2->second->latency(); });
+		for (auto itPeer = peers.begin(); itPeer != itLast; ++itPeer)
+			bestList.emplace((*itPeer)->first);
+
+		// Add one random peer (not already in the list)
+		if (count > bestList.size()) {
+			UInt32 index = Util::Random<UInt32>() % count;
+			while (!bestList.emplace(_groupAddresses.peerId(index)).second)
+				index = _groupAddresses.move(index, 1);
 		}
 
 		// Find 2 log(N) peers with location + 1/2, 1/4, 1/8 ...
 		UInt32 bests = bestList.size(), estimatedCount = targetNeighborsCount();
-		if (_mapGroupAddress.size() > bests && estimatedCount > bests) {
-			UInt32 count = estimatedCount - bests;
-			if (count > _mapGroupAddress.size() - bests)
-				count = _mapGroupAddress.size() - bests;
-
-			auto itNode = _mapGroupAddress.lower_bound(groupAddress);
-			UInt32 rest = (_mapGroupAddress.size() / 2) - 1;
-			UInt32 step = rest / (2 * count);
-			for (; count > 0; count--) {
-				if (distance(itNode, _mapGroupAddress.end()) <= step) {
-					itNode = _mapGroupAddress.begin();
-				}
-				advance(itNode, step);
-				while (!bestList.emplace(itNode->second).second) { // If not added go to next
-					if (++itNode == _mapGroupAddress.end())
-						itNode = _mapGroupAddress.begin();
-				}
+		if (count > bests && estimatedCount > bests) {
+			UInt32 fingers = estimatedCount - bests;
+			if (fingers > count - bests)
+				fingers = count - bests;
+
+			UInt32 index = _groupAddresses.lowerBound(groupAddress);
+			UInt32 rest = (count / 2) - 1;
+			UInt32 step = rest / (2 * fingers);
+			for (; fingers > 0; fingers--) {
+				index = (count - index <= step) ? step : index + step;
+				while (!bestList.emplace(_groupAddresses.peerId(index)).second) // If not added go to next
+					index = _groupAddresses.move(index, 1);
 			}
 		}
 	}
 
 	if (bestList == _bestList && _mapPeers.size() != _bestList.size())
-		INFO("Best Peer - Peers connected : ", _mapPeers.size(), "/", _mapGroupAddress.size(), " ; target count : ", _bestList.size(), " ; GroupMedia count : ", _mapGroupMedias.size())
+		INFO("Best Peer - Peers connected : ", _mapPeers.size(), "/", count, " ; target count : ", _bestList.size(), " ; GroupMedia count : ", _mapGroupMedias.size())
 }
 
 void NetGroup::sendGroupReport(P2PSession* pPeer, bool initiator) {
 	TRACE("Preparing the Group Report message (type 0A) for peer ", pPeer->peerId)
 
-	auto itNode = _mapHeardList.find(pPeer->peerId);
+	PeerId peerId(BIN pPeer->rawId.data() + 2);
+	auto itNode = _mapHeardList.find(peerId);
 	if (itNode == _mapHeardList.end()) {
 		ERROR("Unable to find the peer ", pPeer->peerId, " in the Heard list") // implementation error
 		return;
 	}
 
-	set<string> bestList;
-	buildBestList(itNode->second.groupAddress, bestList);
+	// Calculate the best list of the peer only if the heard list has changed
+	TargetBestList& target = _mapTargetBestLists[peerId];
+	if (target.version != _groupAddresses.version() || target.time.isElapsed(NETGROUP_BEST_LIST_DELAY)) {
+		buildBestList(itNode->second.groupAddress, target.peers);
+		target.version = _groupAddresses.version();
+		target.time.update();
+	}
+	const set<PeerId>& bestList = target.peers;
 
-	// Calculate the total size to allocate sufficient memory
+	// Collect the nodes and calculate the total size to allocate sufficient memory
+	vector<map<PeerId, GroupNode>::iterator> nodes;
+	nodes.reserve(bestList.size());
 	UInt32 sizeTotal = (UInt32)(pPeer->peerAddress().host().size() + _conn.serverAddress().host().size() + 12);
 	Int64 timeNow(Time::Now());
-	for (auto it1 : bestList) {
-		itNode = _mapHeardList.find(it1);
-		if (itNode != _mapHeardList.end())
-			sizeTotal += itNode->second.addressesSize() + PEER_ID_SIZE + 5 + ((itNode->second.lastGroupReport > 0) ? Util::Get7BitValueSize((timeNow - itNode->second.lastGroupReport) / 1000) : 1);
+	for (const PeerId& id : bestList) {
+		itNode = _mapHeardList.find(id);
+		if (itNode != _mapHeardList.end()) {
+			nodes.emplace_back(itNode);
+			sizeTotal += itNode->second.reportEntrySize() + PEER_ID_SIZE + 3 + ((itNode->second.lastGroupReport > 0) ? Util::Get7BitValueSize((timeNow - itNode->second.lastGroupReport) / 1000) : 1);
+		}
 	}
 	_reportBuffer.resize(sizeTotal);
 
@@ -469,22 +475,14 @@ void NetGroup::sendGroupReport(P2PSession* pPeer, bool initiator) {
 	RTMFP::WriteAddress(writer, _conn.serverAddress(), RTMFP::ADDRESS_REDIRECTION);
 	writer.write8(0);
 
-	for (auto it2 : bestList) {
-		itNode = _mapHeardList.find(it2);
-		if (itNode != _mapHeardList.end()) {
-
-			UInt64 timeElapsed = (UInt64)((itNode->second.lastGroupReport > 0) ? ((timeNow - itNode->second.lastGroupReport) / 1000) : 0);
-			TRACE("Group 0A argument - Peer ", itNode->first, " - elapsed : ", timeElapsed) //, " (latency : ", itPeer.second->latency(), ")")
-			writer.write8(0x22).write(itNode->second.rawId.data(), PEER_ID_SIZE+2);
-			writer.write7BitLongValue(timeElapsed);
-			writer.write8(itNode->second.addressesSize());
-			writer.write8(0x0A);
-			RTMFP::WriteAddress(writer, itNode->second.hostAddress, RTMFP::ADDRESS_REDIRECTION);
-			for (auto itAddress : itNode->second.addresses)
-				if (itAddress.second != RTMFP::ADDRESS_LOCAL)
-					RTMFP::WriteAddress(writer, itAddress.first, itAddress.second);
-			writer.write8(0);
-		}
+	// Write the entries, only the time elapsed is not pre-serialized
+	for (auto& itEntry : nodes) {
+		GroupNode& node = itEntry->second;
+		UInt64 timeElapsed = (UInt64)((node.lastGroupReport > 0) ? ((timeNow - node.lastGroupReport) / 1000) : 0);
+		TRACE("Group 0A argument - Peer ", itEntry->first.toString(), " - elapsed : ", timeElapsed)
+		writer.write8(0x22).write(node.rawId, PEER_ID_SIZE+2);
+		writer.write7BitLongValue(timeElapsed);
+		writer.write(node.reportEntry(), node.reportEntrySize());
 	}
 
 	TRACE("Sending the group report to ", pPeer->peerId)
@@ -503,19 +501,79 @@ void NetGroup::manageBestConnections() {
 	}
 
 	// Connect to new peers
-	for (auto it : _bestList) {
+	for (const PeerId& it : _bestList) {
 		if (_mapPeers.find(it) == _mapPeers.end()) {
 			auto itNode = _mapHeardList.find(it);
 			if (itNode == _mapHeardList.end())
-				WARN("Unable to find the peer ", it) // implementation error, should not happen
+				WARN("Unable to find the peer ", it.toString()) // implementation error, should not happen
 			else {
-				DEBUG("Best Peer - Connecting to peer ", it, "...")
-				_conn.connect2Peer(it.c_str(), stream.c_str(), itNode->second.addresses, itNode->second.hostAddress);
+				string peerId(it.toString());
+				DEBUG("Best Peer - Connecting to peer ", peerId, "...")
+				PEER_LIST_ADDRESS_TYPE addresses;
+				SocketAddress hostAddress;
+				itNode->second.readAddresses(addresses, hostAddress);
+				_conn.connect2Peer(peerId, stream.c_str(), addresses, hostAddress);
+			}
+		}
+	}
+}
+
+void NetGroup::addPeerMedia(const string& peerId, shared_ptr<PeerMedia>& pPeerMedia, const string& stream, const string& streamKey, shared_ptr<RTMFPGroupConfig>& pParameters) {
+
+	// Create the Group Media if it does not exists
+	auto itGroupMedia = _mapGroupMedias.lower_bound(streamKey);
+	if (itGroupMedia == _mapGroupMedias.end() || itGroupMedia->first != streamKey) {
+		itGroupMedia = _mapGroupMedias.emplace_hint(itGroupMedia, piecewise_construct, forward_as_tuple(streamKey), forward_as_tuple(_conn.poolBuffers(), stream, streamKey, pParameters));
+		itGroupMedia->second.subscribe(onGroupPacket);
+		DEBUG("Creation of GroupMedia ", itGroupMedia->second.id," for the stream ", stream, " :\n", Util::FormatHex(BIN streamKey.data(), streamKey.size(), LOG_BUFFER))
+	}
+	
+	// And finally try to add the peer and send the GroupMedia subscription
+	itGroupMedia->second.addPeer(peerId, pPeerMedia);
+}
+
+void NetGroup::acceptPendingMedias() {
+
+	auto itPending = _pendingMedias.begin();
+	while (itPending != _pendingMedias.end()) {
+		const string* pStream = NULL;
+		{
+			lock_guard<mutex> lock(_mutexStreams);
+			auto itStream = _streams.find(itPending->first);
+			if (itStream != _streams.end())
+				pStream = &*itStream;
+		}
+
+		auto itMedia = itPending->second.begin();
+		while (itMedia != itPending->second.end()) {
+			shared_ptr<PeerMedia> pPeerMedia = itMedia->pPeerMedia.lock();
+			if (pPeerMedia && pPeerMedia->idFlow && !pStream) {
+				++itMedia;
+				continue; // still not registered
+			}
+			if (pPeerMedia && pPeerMedia->idFlow) {
+				DEBUG("Accepting the stream ", *pStream, " offered by peer ", itMedia->peerId)
+				addPeerMedia(itMedia->peerId, pPeerMedia, *pStream, itMedia->streamKey, itMedia->pParameters);
 			}
+			itMedia = itPending->second.erase(itMedia); // accepted or closed
 		}
+		if (itPending->second.empty())
+			itPending = _pendingMedias.erase(itPending);
+		else
+			++itPending;
 	}
 }
 
+bool NetGroup::addStream(const string& streamName) {
+
+	lock_guard<mutex> lock(_mutexStreams);
+	if (!_streams.emplace(streamName).second)
+		return false;
+
+	INFO("Stream ", streamName, " added to the NetGroup ", idTxt)
+	return true;
+}
+
 unsigned int NetGroup::callFunction(const char* function, int nbArgs, const char** args) {
 
 	for (auto& itGroupMedia : _mapGroupMedias)
@@ -565,7 +623,8 @@ void NetGroup::ReadGroupConfig(shared_ptr<RTMFPGroupConfig>& parameters, PacketR
 }
 
 bool NetGroup::readGroupReport(PacketReader& packet) {
-	string tmp, newPeerId, rawId;
+	string tmp, rawId;
+	PeerId newPeerId;
 	SocketAddress myAddress, serverAddress;
 	UInt8 addressType;
 	PEER_LIST_ADDRESS_TYPE listAddresses;
@@ -606,12 +665,12 @@ bool NetGroup::readGroupReport(PacketReader& packet) {
 		size = packet.read8();
 		if (size == 0x22) {
 			packet.read(size, rawId);
-			Util::FormatHex(BIN rawId.data() + 2, PEER_ID_SIZE, newPeerId);
 			if (String::ICompare(rawId, "\x21\x0F", 2) != 0) {
-				ERROR("Unexpected parameter : ", newPeerId, " - Expected Peer Id")
+				ERROR("Unexpected parameter : ", Util::FormatHex(BIN rawId.data(), rawId.size(), LOG_BUFFER), " - Expected Peer Id")
 				break;
 			}
-			TRACE("Group Report - Peer ID : ", newPeerId)
+			newPeerId = PeerId(BIN rawId.data() + 2);
+			TRACE("Group Report - Peer ID : ", newPeerId.toString())
 		}
 		else if (size > 7)
 			packet.next(size); // ignore the addresses if peerId not set
@@ -623,14 +682,14 @@ bool NetGroup::readGroupReport(PacketReader& packet) {
 		size = packet.read8(); // Addresses size
 
 		// New peer, read its addresses
-		if (size >= 0x08 && newPeerId != _conn.peerId() && _mapHeardList.find(newPeerId) == _mapHeardList.end() && *packet.current() == 0x0A) {
+		if (size >= 0x08 && newPeerId != _myPeerId && _mapHeardList.find(newPeerId) == _mapHeardList.end() && *packet.current() == 0x0A) {
 
 			BinaryReader addressReader(packet.current() + 1, size - 1); // +1 to ignore 0A
 			hostAddress = _conn.serverAddress(); // default host is the same as ours
 			listAddresses.clear();
 			if (RTMFP::ReadAddresses(addressReader, listAddresses, hostAddress)) {
 				newPeers = true;
-				addPeer2HeardList(newPeerId.c_str(), rawId.data(), listAddresses, hostAddress, time);  // To avoid memory sharing we use c_str() (copy-on-write implementation on linux)
+				addPeer2HeardList(newPeerId.toString(), rawId.data(), listAddresses, hostAddress, time);
 			}
 		}
 		packet.next(size);
@@ -32,9 +32,11 @@ using namespace std;
 
 UInt32 P2PSession::P2PSessionCounter = 2000000;
 
-P2PSession::P2PSession(RTMFPSession* parent, string id, Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, 
+P2PSession::P2PSession(RTMFPSession* parent, string id, Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, OnMediaBatchEvent pOnMediaBatch, OnStreamOpenEvent pOnStreamOpen, 
 		const Mona::SocketAddress& host, bool responder, bool group) : _responder(responder), peerId(id), rawId("\x21\x0f"), hostAddress(host), _parent(parent), _groupBeginSent(false), 
-		groupReportInitiator(false), _groupConnectSent(false), _isGroup(group), groupFirstReportSent(false), FlowManager(invoker, pOnSocketError, pOnStatusEvent, pOnMediaEvent) {
+		groupReportInitiator(false), _groupConnectSent(false), _isGroup(group), groupFirstReportSent(false), FlowManager(invoker, pOnSocketError, pOnStatusEvent, pOnMediaEvent, pOnMediaBatch, pOnStreamOpen) {
+	setMaxReadDuration(parent->maxReadDuration());
+
 	onGroupHandshake = [this](const string& groupId, const string& key, const string& peerId) {
 		handleGroupHandshake(groupId, key, peerId);
 	};
@@ -186,6 +188,14 @@ P2PSession::~P2PSession() {
 	_parent = NULL;
 }
 
+void P2PSession::flushMedia() {
+	FlowManager::flushMedia();
+
+	// NetGroup media are pushed to the parent session
+	if (_isGroup && _parent)
+		_parent->flushMedia();
+}
+
 void P2PSession::close(bool abrupt) {
 	if (status == RTMFP::FAILED)
 		return;
@@ -510,6 +520,11 @@ void P2PSession::handleDataAvailable(bool isAvailable) {
 	_parent->setDataAvailable(isAvailable); // only for P2P direct play
 }
 
+void P2PSession::handleStatusEvent() {
+
+	_parent->setStatusEvent();
+}
+
 void P2PSession::askPeer2Disconnect() {
 	if (_pReportWriter && _lastTryDisconnect.isElapsed(NETGROUP_DISCONNECT_DELAY)) {
 		DEBUG("Best Peer - Asking ", peerId, " to close")
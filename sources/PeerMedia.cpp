@@ -27,7 +27,10 @@ using namespace Mona;
 using namespace std;
 
 PeerMedia::PeerMedia(P2PSession* pSession, shared_ptr<RTMFPWriter>& pMediaReportWriter) : _pMediaReportWriter(pMediaReportWriter), _pParent(pSession), _idFragmentsMapIn(0), _idFragmentsMapOut(0), 
-	idFlow(0), idFlowMedia(0), pStreamKey(NULL), _pushOutMode(0), pushInMode(0), groupMediaSent(false), _fragmentsMap(MAX_FRAGMENT_MAP_SIZE) {
+	idFlow(0), idFlowMedia(0), pStreamKey(NULL), _pushOutMode(0), pushInMode(0), groupMediaSent(false), _fragmentsBase(0),
+	pullsInFlight(0), _pullReliability(1) {
+	memset(_pushDelays, 0, sizeof(_pushDelays));
+	memset(_pushCounts, 0, sizeof(_pushCounts));
 
 }
 
@@ -135,14 +138,30 @@ void PeerMedia::onFragmentsMap(UInt64 id, const UInt8* data, UInt32 size) {
 	}
 
 	_idFragmentsMapIn = id;
-	if (!size)
-		return; // 0 size protection
-
 	if (size > MAX_FRAGMENT_MAP_SIZE)
 		WARN("Size of fragment map > max size : ", size)
-	_fragmentsMap.resize(size);
-	BinaryWriter writer(_fragmentsMap.data(), size);
-	writer.write(data, size);
+
+	// Decode the map into the bitset (byte n gives fragments id - 1 - 8*n to id - 8 - 8*n)
+	UInt64 first = (id > (UInt64)size * 8) ? id - (UInt64)size * 8 : 1;
+	UInt64 base = first >> 6;
+	vector<UInt64> fragments((size_t)((id >> 6) - base + 1));
+	fragments[(id >> 6) - base] |= 1ULL << (id & 63);
+	for (UInt32 offset = 0; offset < size; ++offset) {
+		UInt8 byte = data[offset];
+		for (UInt64 index = id - 1 - offset * 8; byte; byte >>= 1, --index) {
+			if ((byte & 1) && index >= first && index < id)
+				fragments[(index >> 6) - base] |= 1ULL << (index & 63);
+		}
+	}
+
+	// Keep the blacklisted fragments which are still in the window
+	vector<UInt64> blacklist(fragments.size());
+	for (UInt64 word = max(base, _fragmentsBase); word < _fragmentsBase + _blacklistPull.size() && word < base + blacklist.size(); ++word)
+		blacklist[word - base] = _blacklistPull[word - _fragmentsBase];
+
+	_fragments = move(fragments);
+	_blacklistPull = move(blacklist);
+	_fragmentsBase = base;
 }
 
 void PeerMedia::onFragment(UInt8 marker, UInt64 id, UInt8 splitedNumber, UInt8 mediaType, UInt32 time, PacketReader& packet, double lostRate) {
@@ -160,10 +179,12 @@ bool PeerMedia::checkMask(UInt8 bitNumber) {
 	UInt64 lastFragment = _idFragmentsMapIn - (_idFragmentsMapIn % 8);
 	lastFragment += ((_idFragmentsMapIn % 8) > bitNumber) ? bitNumber : bitNumber - 8;
 
-	TRACE("Searching ", lastFragment, " into ", Format<UInt8>("%.2x", *_fragmentsMap.data()), " ; (current id : ", _idFragmentsMapIn, ") ; result = ",
-		((*_fragmentsMap.data()) & (1 << (8 - _idFragmentsMapIn + lastFragment))) > 0, " ; bit : ", bitNumber, " ; address : ", _pParent->peerId, " ; latency : ", _pParent->latency())
-
-	return ((*_fragmentsMap.data()) & (1 << (8 - _idFragmentsMapIn + lastFragment))) > 0;
+	// Same bit as before the bitset : bit (8 - id + lastFragment) of the first map byte, which gives fragment id - 9 + (id - lastFragment)
+	UInt64 index = _idFragmentsMapIn - 9 + (_idFragmentsMapIn - lastFragment);
+	UInt64 word = (index >> 6) - _fragmentsBase;
+	bool result = (index >> 6) >= _fragmentsBase && word < _fragments.size() && (_fragments[(size_t)word] & (1ULL << (index & 63)));
+	TRACE("Searching ", lastFragment, " (current id : ", _idFragmentsMapIn, ") ; result = ", result, " ; bit : ", bitNumber, " ; address : ", _pParent->peerId, " ; latency : ", _pParent->latency())
+	return result;
 }
 
 bool PeerMedia::hasFragment(UInt64 index) {
@@ -175,22 +196,28 @@ bool PeerMedia::hasFragment(UInt64 index) {
 		TRACE("Searching ", index, " OK into ", _pParent->peerId, ", current id : ", _idFragmentsMapIn)
 		return true; // Fragment is the last one or peer has all fragments
 	}
-	else if (_blacklistPull.find(index) != _blacklistPull.end()) {
-		TRACE("Searching ", index, " impossible into ", _pParent->peerId, " a request has already failed")
-		return false;
-	}
 
-	UInt32 offset = (UInt32)((_idFragmentsMapIn - index - 1) / 8);
-	UInt32 rest = ((_idFragmentsMapIn - index - 1) % 8);
-	if (offset > _fragmentsMap.size()) {
-		TRACE("Searching ", index, " impossible into ", _pParent->peerId, ", out of buffer (", offset, "/", _fragmentsMap.size(), ")")
+	UInt64 word = index >> 6;
+	if (word < _fragmentsBase || word - _fragmentsBase >= _fragments.size()) {
+		TRACE("Searching ", index, " impossible into ", _pParent->peerId, ", out of buffer (current id : ", _idFragmentsMapIn, ")")
 		return false; // Fragment deleted from buffer
 	}
+	word -= _fragmentsBase;
+	if (_blacklistPull[(size_t)word] & (1ULL << (index & 63))) {
+		TRACE("Searching ", index, " impossible into ", _pParent->peerId, " a request has already failed")
+		return false;
+	}
 
-	TRACE("Searching ", index, " into ", Format<UInt8>("%.2x", *(_fragmentsMap.data() + offset)), " ; (current id : ", _idFragmentsMapIn, ", offset : ", offset, ") ; result = ",
-		(*(_fragmentsMap.data() + offset) & (1 << rest)) > 0)
+	TRACE("Searching ", index, " into ", _pParent->peerId, " (current id : ", _idFragmentsMapIn, ") ; result = ", (_fragments[(size_t)word] & (1ULL << (index & 63))) > 0)
+	return (_fragments[(size_t)word] & (1ULL << (index & 63))) > 0;
+}
 
-	return (*(_fragmentsMap.data() + offset) & (1 << rest)) > 0;
+UInt64 PeerMedia::fragmentsAvailable(UInt64 index) {
+	UInt64 word = index >> 6;
+	if (!_idFragmentsMapIn || word < _fragmentsBase || word - _fragmentsBase >= _fragments.size())
+		return 0;
+	word -= _fragmentsBase;
+	return _fragments[(size_t)word] & ~_blacklistPull[(size_t)word];
 }
 
 void PeerMedia::onPlayPull(UInt64 index) {
@@ -204,9 +231,33 @@ void PeerMedia::sendPull(UInt64 index) {
 
 	TRACE("Sending pull request for fragment ", index, " to peer ", _pParent->peerId);
 	_pMediaReportWriter->writeGroupPull(index);
+	++pullsInFlight;
+}
+
+void PeerMedia::endPull(PullResult result) {
+	if (pullsInFlight)
+		--pullsInFlight;
+	if (result == PULL_RECEIVED)
+		_pullReliability = _pullReliability * 0.9 + 0.1;
+	else if (result == PULL_TIMEOUT)
+		_pullReliability *= 0.9;
+}
+
+void PeerMedia::addPushDelay(UInt8 bitNumber, UInt32 delay) {
+	_pushDelays[bitNumber] = _pushCounts[bitNumber]++ ? (_pushDelays[bitNumber] * 0.9 + delay * 0.1) : delay;
+}
+
+UInt16 PeerMedia::latency() {
+	return _pParent->latency();
+}
+
+double PeerMedia::pullScore() {
+	return (latency() + 10) * (pullsInFlight + 1) / (_pullReliability + 0.01);
 }
 
 void PeerMedia::addPullBlacklist(UInt64 idFragment) {
-	// TODO: delete old blacklisted fragments
-	_blacklistPull.emplace(idFragment);
+	// Fragments out of the window are already unavailable
+	UInt64 word = idFragment >> 6;
+	if (word >= _fragmentsBase && word - _fragmentsBase < _blacklistPull.size())
+		_blacklistPull[(size_t)(word - _fragmentsBase)] |= 1ULL << (idFragment & 63);
 }
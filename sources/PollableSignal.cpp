@@ -0,0 +1,131 @@
+/*
+Copyright 2016 Thomas Jammet
+mathieu.poux[a]gmail.com
+jammetthomas[a]gmail.com
+
+This file is part of Librtmfp.
+
+Librtmfp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Librtmfp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PollableSignal.h"
+#if defined(__linux__)
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#elif !defined(_WIN32)
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using namespace Mona;
+using namespace std;
+
+mutex				PollableSignal::Mutex;
+condition_variable	PollableSignal::Condition;
+atomic<UInt32>		PollableSignal::Waiters(0);
+
+PollableSignal::PollableSignal() : _set(false) {
+	_fds[0] = _fds[1] = -1;
+#if defined(__linux__)
+	_fds[0] = _fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+	if (pipe(_fds) == 0) {
+		for (int fd : _fds) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	} else
+		_fds[0] = _fds[1] = -1;
+#endif
+}
+
+PollableSignal::~PollableSignal() {
+#if !defined(_WIN32)
+	if (_fds[0] >= 0)
+		close(_fds[0]);
+	if (_fds[1] >= 0 && _fds[1] != _fds[0])
+		close(_fds[1]);
+#endif
+}
+
+void PollableSignal::set() {
+	if (_set.load(memory_order_acquire))
+		return; // already set, nothing to lock (called for each media packet)
+	{
+		lock_guard<mutex> lock(_mutex);
+		if (_set.exchange(true))
+			return; // set in the meantime
+#if defined(__linux__)
+		UInt64 value(1);
+		if (_fds[1] >= 0 && ::write(_fds[1], &value, sizeof(value)) < 0) {}
+#elif !defined(_WIN32)
+		char value(1);
+		if (_fds[1] >= 0 && ::write(_fds[1], &value, sizeof(value)) < 0) {}
+#endif
+	}
+
+	// Wake up the waiting threads only if there are some
+	if (!Waiters.load())
+		return;
+	{
+		lock_guard<mutex> lock(Mutex); // a waiter is either before its test or waiting on the condition
+	}
+	Condition.notify_all();
+}
+
+void PollableSignal::reset() {
+	if (!_set.load(memory_order_acquire))
+		return; // already reset
+	lock_guard<mutex> lock(_mutex);
+	if (!_set.exchange(false))
+		return; // reset in the meantime
+#if defined(__linux__)
+	UInt64 value;
+	if (_fds[0] >= 0 && ::read(_fds[0], &value, sizeof(value)) < 0) {}
+#elif !defined(_WIN32)
+	char value;
+	if (_fds[0] >= 0 && ::read(_fds[0], &value, sizeof(value)) < 0) {}
+#endif
+}
+
+bool PollableSignal::wait(UInt32 millisec) {
+	++Waiters;
+	bool result;
+	{
+		unique_lock<mutex> lock(Mutex);
+		result = Condition.wait_for(lock, chrono::milliseconds(millisec), [this]() { return _set.load(); });
+	}
+	--Waiters;
+	return result;
+}
+
+UInt32 PollableSignal::WaitAny(const vector<PollableSignal*>& signals, UInt32 millisec) {
+	UInt32 count(0);
+	auto countSet = [&signals, &count]() {
+		count = 0;
+		for (PollableSignal* pSignal : signals) {
+			if (pSignal && pSignal->_set.load())
+				++count;
+		}
+		return count > 0;
+	};
+
+	++Waiters;
+	{
+		unique_lock<mutex> lock(Mutex);
+		Condition.wait_for(lock, chrono::milliseconds(millisec), countSet);
+	}
+	--Waiters;
+	return count;
+}
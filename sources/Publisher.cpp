@@ -25,15 +25,50 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 #include "Mona/Logs.h"
 #include "GroupListener.h"
 #include "Invoker.h"
+#include "Mona/PoolThreads.h"
 
 using namespace Mona;
 using namespace std;
 
-Publisher::Publisher(const string& name, Invoker& invoker, bool audioReliable, bool videoReliable, bool p2p) : _running(false), _new(false), _name(name), publishAudio(true), publishVideo(true),
+/**************************************************
+ListenerRunner executes an action of the Publisher
+on one listener in a worker thread (each listener
+always uses the same thread to keep the order)
+*/
+class ListenerRunner : public Runner, public virtual Object {
+public:
+	ListenerRunner(Publisher& publisher, Listener& listener, Publisher::ListenerAction action, UInt32 time, const shared_ptr<Buffer>& pFrame, bool keyFrame) :
+		Runner("ListenerRunner"), _publisher(publisher), _listener(listener), _action(action), _time(time), _pFrame(pFrame), _keyFrame(keyFrame) {}
+
+private:
+	bool run(Exception& ex) {
+		switch (_action) {
+		case Publisher::LISTENER_AUDIO:
+			_listener.pushAudio(_time, _pFrame ? _pFrame->data() : NULL, _pFrame ? _pFrame->size() : 0); break;
+		case Publisher::LISTENER_VIDEO:
+			_listener.pushVideo(_time, _pFrame ? _pFrame->data() : NULL, _pFrame ? _pFrame->size() : 0, _keyFrame); break;
+		case Publisher::LISTENER_FLUSH:
+			_listener.flush(); break;
+		}
+		_publisher.endListenerTask();
+		return true;
+	}
+
+	Publisher&					_publisher;
+	Listener&					_listener;
+	Publisher::ListenerAction	_action;
+	UInt32						_time;
+	shared_ptr<Buffer>			_pFrame;
+	bool						_keyFrame;
+};
+
+Publisher::Publisher(const string& name, Invoker& invoker, bool audioReliable, bool videoReliable, bool p2p, bool asynchronous) : _running(false), _queueFull(false), _multiThreaded(false), _listenerTasks(0), _gopCacheSize(0), _gopCacheMax(0), _new(false), _name(name), publishAudio(true), publishVideo(true),
 	_audioReliable(audioReliable), _videoReliable(videoReliable), _audioCodecBuffer(invoker.poolBuffers), _videoCodecBuffer(invoker.poolBuffers), isP2P(p2p),
-	_pos(0), _invoker(invoker), Task((TaskHandler&)invoker) {
+	_data(NULL), _size(0), _consumed(0), _invoker(invoker), Task((TaskHandler&)invoker) {
 
 	INFO("Initialization of the publisher ", _name, " (audioReliable : ", _audioReliable, " - videoReliable : ", _videoReliable, ")")
+	if (asynchronous)
+		_pQueue.reset(new MediaRing());
 }
 
 Publisher::~Publisher() {
@@ -43,6 +78,7 @@ Publisher::~Publisher() {
 		while (!_listeners.empty())
 			removeListener(_listeners.begin()->first);
 	}
+	waitListeners();
 	if (_running)
 		ERROR("Publication ",_name," running is deleting")
 	DEBUG("Publication ",_name," deleted");
@@ -56,13 +92,63 @@ void Publisher::removeListener(const string& identifier) {
 	}
 	Listener* pListener = it->second;
 	_listeners.erase(it);
+	waitListeners(); // the listener can still be used by a worker thread
 	delete pListener;
 }
 
+void Publisher::dispatch(Listener& listener, ListenerAction action, UInt32 time, const UInt8* data, UInt32 size, bool keyFrame, shared_ptr<Buffer>* pFrame) {
+	if (listener.pThread || (_multiThreaded && listener.threadable())) {
+		// Copy the frame once for all the listeners
+		shared_ptr<Buffer> pCopy(pFrame ? *pFrame : shared_ptr<Buffer>());
+		if (size && !pCopy) {
+			pCopy.reset(new Buffer(size));
+			memcpy(pCopy->data(), data, size);
+			if (pFrame)
+				*pFrame = pCopy;
+			_frames.emplace_back(pCopy); // unreliable messages reference the frame until the writers are flushed
+		}
+		{
+			lock_guard<mutex> lock(_listenerTasksMutex);
+			++_listenerTasks;
+		}
+		Exception ex;
+		shared_ptr<ListenerRunner> pRunner(new ListenerRunner(*this, listener, action, time, pCopy, keyFrame));
+		PoolThread* pThread = _invoker.poolThreads.enqueue<ListenerRunner>(ex, pRunner, listener.pThread);
+		if (pThread) {
+			listener.pThread = pThread;
+			return;
+		}
+		WARN("Unable to use a worker thread for a listener of ", _name, " : ", ex.error())
+		endListenerTask();
+		waitListeners(); // keep the order of actions
+	}
+
+	switch (action) {
+	case LISTENER_AUDIO:
+		listener.pushAudio(time, data, size); break;  // listener can be removed in this call
+	case LISTENER_VIDEO:
+		listener.pushVideo(time, data, size, keyFrame); break; // listener can be removed in this call
+	case LISTENER_FLUSH:
+		listener.flush(); break;
+	}
+}
+
+void Publisher::endListenerTask() {
+	lock_guard<mutex> lock(_listenerTasksMutex);
+	if (!--_listenerTasks)
+		_listenerTasksCondition.notify_all();
+}
+
+void Publisher::waitListeners() {
+	unique_lock<mutex> lock(_listenerTasksMutex);
+	_listenerTasksCondition.wait(lock, [this]() { return !_listenerTasks; });
+}
+
 void Publisher::start() {
 	if (_running)
 		return;
 	INFO("Publication ", _name, " started")
+	waitListeners();
 	_running = true;  // keep before startPublishing()
 	for (auto& it : _listeners) {
 		it.second->startPublishing();
@@ -74,6 +160,7 @@ void Publisher::stop() {
 	if (!_running)
 		return; // already done
 	INFO("Publication ", _name, " stopped")
+	waitListeners();
 	for (auto& it : _listeners) {
 		it.second->stopPublishing();
 		it.second->flush(); // flush possible last media + messages in stopPublishing
@@ -87,23 +174,97 @@ void Publisher::stop() {
 	_running = false;
 	_videoCodecBuffer.release();
 	_audioCodecBuffer.release();
+	clearGop();
 }
 
 bool Publisher::publish(const Mona::UInt8* data, Mona::UInt32 size, int& pos) {
-	_reader.reset(new PacketReader(data, size));
-	_pos = pos;
-	if (_reader->available()<14) {
-		DEBUG("Packet too small")
+	if (_pQueue)
+		return publishQueued(data, size, pos);
+
+	_data = data + pos;
+	_size = size - pos;
+	_consumed = 0;
+
+	// Wait for packets to be sent
+	waitHandle();
+	pos += _consumed; // update the position
+	return true;
+}
+
+bool Publisher::publishQueued(const UInt8* data, UInt32 size, int& pos) {
+	_queueFull = false;
+	pos += _demuxer.parse(data + pos, size - pos, [this](UInt8 type, UInt32 time, const UInt8* body, UInt32 bodySize) {
+		if (type != AMF::AUDIO && type != AMF::VIDEO) {
+			WARN("Unhandled packet type : ", type)
+			return true;
+		}
+		if (!_pQueue->writeTag(type, time, body, bodySize))
+			return !(_queueFull = true); // the caller will retry later
 		return true;
+	});
+
+	// Wake up the Invoker thread
+	if (!_pQueue->empty())
+		_invoker.requestFlushPublications();
+	return true;
+}
+
+void Publisher::flushQueue() {
+	replayPending();
+	if (!_pQueue)
+		return;
+
+	UInt32 size(0);
+	const UInt8* tag(NULL);
+	while ((tag = _pQueue->peek(size))) {
+		BinaryReader reader(tag, size);
+		UInt8 type = reader.read8();
+		UInt32 bodySize = reader.read24();
+		UInt32 time = reader.read24();
+		time |= reader.read8() << 24; // extended time
+		reader.next(2); // ignored
+		UInt8 flags = reader.read8(); // internal flags (publishFrame)
+		pushMedia(type, time, reader.current(), bodySize, flags);
+		_pQueue->release();
 	}
+	flush();
+}
 
-	// Wait for packets to be sent
+bool Publisher::publishFrame(AMF::ContentType type, UInt32 time, const UInt8* data, UInt32 size, UInt8 flags) {
+	flags |= PUBLISHER_FRAME_FLAGS;
+	if (_pQueue) {
+		if ((_queueFull = !_pQueue->writeTag(type, time, data, size, flags)))
+			return false; // the caller will retry later
+		_invoker.requestFlushPublications();
+		return true;
+	}
+
+	// Wait for the frame to be sent
+	_frame.type = type;
+	_frame.time = time;
+	_frame.data = data;
+	_frame.size = size;
+	_frame.flags = flags;
 	waitHandle();
-	pos = _pos; // update the position
 	return true;
 }
 
-void Publisher::pushAudio(UInt32 time, const UInt8* data, UInt32 size) {
+void Publisher::pushMedia(UInt8 type, UInt32 time, const UInt8* data, UInt32 size, UInt8 flags) {
+	if (type == AMF::AUDIO)
+		pushAudio(time, data, size, (flags & PUBLISHER_FRAME_FLAGS) ? (flags & PUBLISHER_FRAME_CONFIG) > 0 : RTMFP::IsAACCodecInfos(data, size));
+	else if (type == AMF::VIDEO) {
+		if (flags & PUBLISHER_FRAME_FLAGS)
+			pushVideo(time, data, size, (flags & PUBLISHER_FRAME_KEY) > 0, (flags & PUBLISHER_FRAME_CONFIG) > 0);
+		else if (!size)
+			pushVideo(time, data, size, false, false); // empty FLV tag, nothing to analyze
+		else
+			pushVideo(time, data, size, RTMFP::IsKeyFrame(data, size), RTMFP::IsH264CodecInfos(data, size));
+	}
+	else
+		WARN("Unhandled packet type : ", type)
+}
+
+void Publisher::pushAudio(UInt32 time, const UInt8* data, UInt32 size, bool config) {
 	if (!_running) {
 		ERROR("Audio packet pushed on '", _name, "' publication stopped");
 		return;
@@ -116,7 +277,7 @@ void Publisher::pushAudio(UInt32 time, const UInt8* data, UInt32 size) {
 	_audioQOS.add(packet.available() + 4, ping, lostRate); // 4 for time encoded*/
 
 	// save audio codec packet for future listeners
-	if (RTMFP::IsAACCodecInfos(data, size)) {
+	if (config) {
 		DEBUG("AAC codec infos received on publication ", _name)
 		// AAC codec && settings codec informations
 		_audioCodecBuffer->resize(size, false);
@@ -124,13 +285,18 @@ void Publisher::pushAudio(UInt32 time, const UInt8* data, UInt32 size) {
 	}
 
 	_new = true;
+	shared_ptr<Buffer> pFrame;
 	auto it = _listeners.begin();
 	while (it != _listeners.end()) {
-		(it++)->second->pushAudio(time, data, size);  // listener can be removed in this call
+		Listener& listener = *(it++)->second;
+		if (!listener.replaying)
+			dispatch(listener, LISTENER_AUDIO, time, data, size, false, &pFrame);
 	}
+	if (!config)
+		cacheFrame(AMF::AUDIO, time, data, size, false);
 }
 
-void Publisher::pushVideo(UInt32 time, const UInt8* data, UInt32 size) {
+void Publisher::pushVideo(UInt32 time, const UInt8* data, UInt32 size, bool keyFrame, bool config) {
 	if (!_running) {
 		ERROR("Video packet pushed on '", _name, "' publication stopped");
 		return;
@@ -139,7 +305,7 @@ void Publisher::pushVideo(UInt32 time, const UInt8* data, UInt32 size) {
 	//  TRACE("Time Video ",time," => ",Util::FormatHex(packet.current(),16,LOG_BUFFER))
 
 	// save video codec packet for future listeners
-	if (RTMFP::IsH264CodecInfos(data, size)) {
+	if (config) {
 		INFO("H264 codec infos received on publication ", _name)
 		// h264 codec && settings codec informations
 		_videoCodecBuffer->resize(size, false);
@@ -162,9 +328,73 @@ void Publisher::pushVideo(UInt32 time, const UInt8* data, UInt32 size) {
 	}*/
 
 	_new = true;
+	shared_ptr<Buffer> pFrame;
 	auto it = _listeners.begin();
 	while (it != _listeners.end()) {
-		(it++)->second->pushVideo(time, data, size); // listener can be removed in this call
+		Listener& listener = *(it++)->second;
+		if (!listener.replaying)
+			dispatch(listener, LISTENER_VIDEO, time, data, size, keyFrame, &pFrame);
+	}
+	if (!config)
+		cacheFrame(AMF::VIDEO, time, data, size, keyFrame);
+}
+
+void Publisher::cacheFrame(AMF::ContentType type, UInt32 time, const UInt8* data, UInt32 size, bool keyFrame) {
+	if (!_gopCacheMax || !size)
+		return;
+
+	if (type == AMF::VIDEO && keyFrame)
+		clearGop(); // new GOP
+	else if (_gopCache.empty())
+		return; // wait for the first key frame
+
+	if (_gopCacheSize + size > _gopCacheMax) {
+		DEBUG("GOP cache of publication ", _name, " exceeds ", _gopCacheMax, " bytes, disabled until the next key frame")
+		clearGop();
+		return;
+	}
+	_gopCache.emplace_back(type, time, data, size, keyFrame);
+	_gopCacheSize += size;
+}
+
+void Publisher::replayGop(Listener& listener) {
+	if (_gopCache.empty())
+		return;
+
+	DEBUG("Sending ", _gopCache.size(), " frames of the GOP cache to new listener ", listener.identifier)
+	deque<CachedFrame> frames(_gopCache); // buffers are shared, the cache can change during the replay
+	for (CachedFrame& frame : frames) {
+		if (frame.type == AMF::AUDIO)
+			listener.pushAudio(frame.time, frame.pBuffer->data(), frame.pBuffer->size());
+		else
+			listener.pushVideo(frame.time, frame.pBuffer->data(), frame.pBuffer->size(), frame.keyFrame);
+	}
+	listener.flush();
+}
+
+void Publisher::requestReplay(Listener& listener) {
+	listener.replaying = true; // the GOP cache is owned by the Invoker thread
+	{
+		lock_guard<mutex> lock(_replaysMutex);
+		_replays.emplace_back(listener.identifier);
+	}
+	_invoker.requestFlushPublications();
+}
+
+void Publisher::replayPending() {
+	vector<string> replays;
+	{
+		lock_guard<mutex> lock(_replaysMutex);
+		if (_replays.empty())
+			return;
+		replays.swap(_replays);
+	}
+	for (const string& identifier : replays) {
+		auto it = _listeners.find(identifier);
+		if (it == _listeners.end() || !it->second->replaying)
+			continue; // removed in the meantime
+		replayGop(*it->second);
+		it->second->replaying = false;
 	}
 }
 
@@ -174,46 +404,29 @@ void Publisher::flush() {
 	_new = false;
 	map<string, Listener*>::const_iterator it;
 	for (it = _listeners.begin(); it != _listeners.end(); ++it)
-		it->second->flush();
+		dispatch(*it->second, LISTENER_FLUSH);
+
+	// Writers are shared with the connection threads so wait for the end of the fan-out before returning to the Invoker
+	waitListeners();
+	_frames.clear();
 }
 
 void Publisher::handle(Exception& ex) { 
-	if (!_reader)
-		return; // TODO: shouldn't happen
-
-	const UInt8* cur = _reader->current();
-	if (*cur == 'F' && *(++cur) == 'L' && *(++cur) == 'V') { // header
-		_reader->next(13);
-		_pos = 13;
+	replayPending(); // before the new frames
+	if (_frame.data) { // publishFrame
+		pushMedia(_frame.type, _frame.time, _frame.data, _frame.size, _frame.flags);
+		_frame.data = NULL;
+		flush();
+		return;
 	}
+	if (!_data)
+		return; // TODO: shouldn't happen
 
-	// Send all packets
-	while (_reader->available()) {
-		if (_reader->available() < 11) // smaller than flv header
-			break;
-
-		UInt8 type = _reader->read8();
-		UInt32 bodySize = _reader->read24();
-		UInt32 time = _reader->read24();
-		_reader->next(4); // ignored
-
-		if (_reader->available() < bodySize + 4)
-			break; // we will wait for further data
-
-		//TRACE(((type == 0x08) ? "Audio" : ((type == 0x09) ? "Video" : "Unknown")), " packet read - size : ", bodySize, " - time : ", time)
-		if (type == AMF::AUDIO)
-			pushAudio(time, _reader->current(), bodySize);
-		else if (type == AMF::VIDEO)
-			pushVideo(time, _reader->current(), bodySize);
-		else
-			WARN("Unhandled packet type : ", type)
-		_reader->next(bodySize);
-		UInt32 sizeBis = _reader->read32();
-		_pos += bodySize + 15;
-		if (sizeBis != bodySize + 11) {
-			ERROR("Unexpected size found after payload : ", sizeBis, " (expected: ", bodySize + 11, ")")
-			break;
-		}
-	}
+	// Send all complete packets, the incomplete one is kept by the demuxer
+	_consumed = _demuxer.parse(_data, _size, [this](UInt8 type, UInt32 time, const UInt8* body, UInt32 bodySize) {
+		pushMedia(type, time, body, bodySize, 0);
+		return true;
+	});
+	_data = NULL;
 	flush();
 }
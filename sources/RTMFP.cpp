@@ -104,6 +104,33 @@ void RTMFP::Write7BitValue(string& buff,UInt64 value) {
 	String::Append(buff, (char)(max ? value&0xFF : value&0x7F));
 }
 
+bool RTMFP::IsDisposableFrame(const UInt8* data, UInt32 size) {
+	if (!size)
+		return false;
+	if ((*data >> 4) == 3)
+		return true; // disposable inter frame
+	if ((*data & 0x0F) != 7 || size < 5 || data[1] != 1)
+		return false; // not an H264 NALU packet
+
+	// Read the NAL units (4 bytes length), the frame is disposable if all the slices are not referenced
+	bool hasSlice(false);
+	const UInt8* cur(data + 5), *end(data + size);
+	while (end - cur > 4) {
+		UInt32 length = (cur[0] << 24) | (cur[1] << 16) | (cur[2] << 8) | cur[3];
+		cur += 4;
+		if (!length || length > UInt32(end - cur))
+			break;
+		UInt8 type = *cur & 0x1F;
+		if (type >= 1 && type <= 5) {
+			if (*cur & 0x60)
+				return false; // nal_ref_idc != 0
+			hasSlice = true;
+		}
+		cur += length;
+	}
+	return hasSlice;
+}
+
 bool RTMFP::ReadAddresses(BinaryReader& reader, PEER_LIST_ADDRESS_TYPE& addresses, SocketAddress& hostAddress) {
 
 	// Read all addresses
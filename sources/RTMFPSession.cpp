@@ -36,8 +36,8 @@ using namespace std;
 
 UInt32 RTMFPSession::RTMFPSessionCounter = 0x02000000;
 
-RTMFPSession::RTMFPSession(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent) : 
-	_nbCreateStreams(0), _port("1935"), p2pPublishReady(false), p2pPlayReady(false), publishReady(false), connectReady(false), dataAvailable(false), FlowManager(invoker, pOnSocketError, pOnStatusEvent, pOnMediaEvent) {
+RTMFPSession::RTMFPSession(Invoker* invoker, OnSocketError pOnSocketError, OnStatusEvent pOnStatusEvent, OnMediaEvent pOnMediaEvent, OnMediaBatchEvent pOnMediaBatch, OnStreamOpenEvent pOnStreamOpen) : 
+	_nbCreateStreams(0), _port("1935"), _packetBorrowed(false), _pPacketQueue(NULL), _asyncPublish(false), _gopCacheSize(0), _parallelFanOut(false), _statusPending(false), p2pPublishReady(false), p2pPlayReady(false), publishReady(false), connectReady(false), dataAvailable(false), FlowManager(invoker, pOnSocketError, pOnStatusEvent, pOnMediaEvent, pOnMediaBatch, pOnStreamOpen) {
 	onStreamCreated = [this](UInt16 idStream) {
 		return handleStreamCreated(idStream);
 	};
@@ -91,7 +91,7 @@ RTMFPSession::RTMFPSession(Invoker* invoker, OnSocketError pOnSocketError, OnSta
 		// If the peer session doesn't exists we create it
 		if (itPeer == _mapPeersById.end() || itPeer->first != peerId)
 			itPeer = _mapPeersById.emplace_hint(itPeer, piecewise_construct, forward_as_tuple(peerId),
-				forward_as_tuple(new P2PSession(this, peerId, _pInvoker, _pOnSocketError, _pOnStatusEvent, _pOnMedia, _pConnection->address(), true, (bool)_group)));
+				forward_as_tuple(new P2PSession(this, peerId, _pInvoker, _pOnSocketError, _pOnStatusEvent, _pOnMedia, _pOnMediaBatch, _pOnStreamOpen, _pConnection->address(), true, (bool)_group)));
 		itPeer->second->subscribe(pConn);
 		
 		if (itPeer->second->status > RTMFP::HANDSHAKE38) {
@@ -335,7 +335,7 @@ void RTMFPSession::connect2Peer(const string& peerId, const char* streamName, co
 
 	DEBUG("Connecting to peer ", peerId, "...")
 	itPeer = _mapPeersById.emplace_hint(itPeer, piecewise_construct, forward_as_tuple(peerId), 
-		forward_as_tuple(new P2PSession(this, peerId, _pInvoker, _pOnSocketError, _pOnStatusEvent, _pOnMedia, hostAddress, false, (bool)_group)));
+		forward_as_tuple(new P2PSession(this, peerId, _pInvoker, _pOnSocketError, _pOnStatusEvent, _pOnMedia, _pOnMediaBatch, _pOnStreamOpen, hostAddress, false, (bool)_group)));
 
 	shared_ptr<P2PSession> pPeer = itPeer->second;
 	// P2P unicast : add command play to send when connected
@@ -400,10 +400,37 @@ void RTMFPSession::connect2Group(const char* streamName, RTMFPGroupConfig* param
 	DEBUG("Encrypted Group Id : ", groupHex)
 
 	lock_guard<std::mutex> lock(_mutexConnections);
+
+	// Already connected to this NetGroup? Play the stream with the same peers
+	if (_group && _group->idHex == groupHex && !parameters->isPublisher) {
+		if (_group->stream == streamName) {
+			WARN("Stream ", streamName, " is already played in the NetGroup ", groupTxt)
+			return;
+		}
+		{
+			lock_guard<mutex> lockQueues(_mutexGroupQueues); // the queue must exist before the first packet
+			_mapGroupQueues.emplace(streamName, unique_ptr<ReadQueue>(new ReadQueue()));
+		}
+		if (!_group->addStream(streamName))
+			WARN("Stream ", streamName, " is already played in the NetGroup ", groupTxt)
+		return;
+	}
+
 	_group.reset(new NetGroup(groupHex, groupTxt, streamName, *this, parameters));
 	_waitingGroup.push_back(groupHex);
 }
 
+void RTMFPSession::pushMedia(const string& stream, UInt32 time, const MediaSpan* spans, UInt32 count, UInt32 size, double lostRate, bool audio) {
+	ReadQueue* pQueue = (stream == _group->stream) ? NULL : groupQueue(stream); // main stream : no lock
+	handleMedia(pQueue ? *pQueue : _readQueue, stream, time, spans, count, size, lostRate, audio);
+}
+
+FlowManager::ReadQueue* RTMFPSession::groupQueue(const string& stream) {
+	lock_guard<mutex> lock(_mutexGroupQueues);
+	auto itQueue = _mapGroupQueues.find(stream);
+	return (itQueue == _mapGroupQueues.end()) ? NULL : itQueue->second.get();
+}
+
 bool RTMFPSession::read(const char* peerId, UInt8* buf, UInt32 size, int& nbRead) {
 	
 	bool res(true);
@@ -411,15 +438,119 @@ bool RTMFPSession::read(const char* peerId, UInt8* buf, UInt32 size, int& nbRead
 	if (itPeer != _mapPeersById.end() && (!(res = itPeer->second->readAsync(buf, size, nbRead)) || nbRead > 0))
 		return res; // quit if treated
 
-	if (!(res = readAsync(buf, size, nbRead)) || nbRead>0)
+	ReadQueue* pQueue = groupQueue(peerId);
+	if (!(res = readAsync(pQueue ? *pQueue : _readQueue, buf, size, nbRead)) || nbRead>0)
 		return res; // quit if treated
 	return true;
 }
 
+bool RTMFPSession::readPacket(const char* peerId, const UInt8*& tag, UInt32& size) {
+	if (_packetBorrowed)
+		releasePacket(); // only one tag can be borrowed at a time
+
+	bool res(true);
+	auto itPeer = _mapPeersById.find(peerId);
+	if (itPeer != _mapPeersById.end() && (!(res = itPeer->second->readPacket(tag, size)) || tag)) {
+		if (tag) {
+			_pPacketPeer = itPeer->second;
+			_packetBorrowed = true;
+		}
+		return res; // quit if treated
+	}
+
+	ReadQueue* pQueue = groupQueue(peerId);
+	if ((res = FlowManager::readPacket(pQueue ? *pQueue : _readQueue, tag, size)) && tag) {
+		_pPacketQueue = pQueue ? pQueue : &_readQueue;
+		_packetBorrowed = true;
+	}
+	return res;
+}
+
+void RTMFPSession::releasePacket() {
+	if (!_packetBorrowed)
+		return;
+
+	if (_pPacketPeer) {
+		_pPacketPeer->releasePacket();
+		_pPacketPeer.reset();
+	}
+	else
+		FlowManager::releasePacket(*_pPacketQueue);
+	_packetBorrowed = false;
+}
+
+UInt64 RTMFPSession::droppedDuration() {
+	UInt64 duration = FlowManager::droppedDuration();
+
+	lock_guard<mutex> lock(_mutexConnections);
+	for (auto& itPeer : _mapPeersById)
+		duration += itPeer.second->droppedDuration();
+	return duration;
+}
+
+bool RTMFPSession::dataWaiting() {
+	if (FlowManager::dataWaiting())
+		return true;
+	{
+		lock_guard<mutex> lock(_mutexGroupQueues);
+		for (auto& itQueue : _mapGroupQueues) {
+			if (!itQueue.second->empty())
+				return true;
+		}
+	}
+	lock_guard<mutex> lock(_mutexConnections);
+	for (auto& itPeer : _mapPeersById) {
+		if (itPeer.second->dataWaiting())
+			return true;
+	}
+	return false;
+}
+
+bool RTMFPSession::dataWaiting(const char* peerId) {
+	{
+		lock_guard<mutex> lock(_mutexConnections);
+		auto itPeer = _mapPeersById.find(peerId);
+		if (itPeer != _mapPeersById.end() && itPeer->second->dataWaiting())
+			return true;
+	}
+	ReadQueue* pQueue = groupQueue(peerId);
+	return !(pQueue ? *pQueue : _readQueue).empty();
+}
+
 void RTMFPSession::handleDataAvailable(bool isAvailable) {
+	// The status is shared by all the read queues, it is cleared only if they are all empty
+	if (!isAvailable && dataWaiting())
+		return;
 	dataAvailable = isAvailable; 
-	if (dataAvailable)
+	if (!dataAvailable && dataWaiting())
+		dataAvailable = true; // written in the meantime
+	if (dataAvailable) {
 		readSignal.set(); // notify the client that data is available
+		readySignal.set();
+	}
+	else if (!_statusPending) {
+		readySignal.reset();
+		if (dataAvailable || _statusPending)
+			readySignal.set(); // set in the meantime
+	}
+}
+
+void RTMFPSession::handleStatusEvent() {
+	_statusPending = true;
+	readySignal.set();
+}
+
+bool RTMFPSession::pollReady() {
+	if (!readySignal.isSet())
+		return false;
+
+	// Status event acknowledged, stay readable only if data is waiting
+	if (_statusPending.exchange(false) && !dataAvailable) {
+		readySignal.reset();
+		if (dataAvailable || _statusPending)
+			readySignal.set(); // set in the meantime
+	}
+	return true;
 }
 
 bool RTMFPSession::write(const UInt8* buf, UInt32 size, int& pos) {
@@ -437,6 +568,20 @@ bool RTMFPSession::write(const UInt8* buf, UInt32 size, int& pos) {
 	return _pPublisher->publish(buf, size, pos);
 }
 
+bool RTMFPSession::writeFrame(AMF::ContentType type, UInt32 time, const UInt8* data, UInt32 size, UInt8 flags, bool& pushed) {
+	pushed = false;
+	if (status == RTMFP::FAILED)
+		return false;
+
+	if (!_pPublisher || !_pPublisher->count()) {
+		DEBUG("Can't write frame because NetStream is not published")
+		return true;
+	}
+
+	pushed = _pPublisher->publishFrame(type, time, data, size, flags);
+	return true;
+}
+
 unsigned int RTMFPSession::callFunction(const char* function, int nbArgs, const char** args, const char* peerId) {
 	// Server call
 	if (!peerId && _pMainStream && _pMainWriter) {
@@ -502,7 +647,9 @@ bool RTMFPSession::handleStreamCreated(UInt16 idStream) {
 		AMFWriter& amfWriter = pWriter->writeInvocation("publish", true);
 		amfWriter.writeString(command.value.c_str(), command.value.size());
 		pWriter->flush();
-		_pPublisher.reset(new Publisher(command.value, *_pInvoker, command.audioReliable, command.videoReliable, false));
+		_pPublisher.reset(new Publisher(command.value, *_pInvoker, command.audioReliable, command.videoReliable, false, _asyncPublish));
+		_pPublisher->setGopCacheSize(_gopCacheSize);
+		_pPublisher->setMultiThreaded(_parallelFanOut);
 		break;
 	}
 	default:
@@ -584,8 +731,11 @@ void RTMFPSession::createWaitingStreams() {
 			INFO("Creating publisher for stream ", itCommand->value, "...")
 			if (_pPublisher)
 				ERROR("A publisher already exists (name : ", _pPublisher->name(), "), command ignored")
-			else
-				_pPublisher.reset(new Publisher(itCommand->value, *_pInvoker, itCommand->audioReliable, itCommand->videoReliable, true));
+			else {
+				_pPublisher.reset(new Publisher(itCommand->value, *_pInvoker, itCommand->audioReliable, itCommand->videoReliable, true, _asyncPublish));
+				_pPublisher->setGopCacheSize(_gopCacheSize);
+				_pPublisher->setMultiThreaded(_parallelFanOut);
+			}
 			_waitingCommands.erase(itCommand++);
 		}
 		else
@@ -29,6 +29,8 @@ along with Librtmfp.  If not, see <http://www.gnu.org/licenses/>.
 using namespace Mona;
 using namespace std;
 
+#define RTMFP_POLL_INTERRUPT_PERIOD	100 // Maximum delay between 2 checks of the interrupt callback in RTMFP_Poll (in msec)
+
 extern "C" {
 
 static std::shared_ptr<Invoker>		GlobalInvoker; // manage threads, sockets and connection
@@ -84,7 +86,11 @@ unsigned int RTMFP_Connect(const char* url, RTMFPConfig* parameters) {
 	Util::UnpackUrl(url, host, publication, query);
 
 	Exception ex;
-	shared_ptr<RTMFPSession> pConn(new RTMFPSession(GlobalInvoker.get(), parameters->pOnSocketError, parameters->pOnStatusEvent, parameters->pOnMedia));
+	shared_ptr<RTMFPSession> pConn(new RTMFPSession(GlobalInvoker.get(), parameters->pOnSocketError, parameters->pOnStatusEvent, parameters->pOnMedia, parameters->pOnMediaBatch, parameters->pOnStreamOpen));
+	pConn->setMaxReadDuration(parameters->maxReadDuration);
+	pConn->setAsyncPublish(parameters->isAsyncPublish > 0);
+	pConn->setGopCacheSize(parameters->gopCacheSize);
+	pConn->setParallelFanOut(parameters->isParallelFanOut > 0);
 	unsigned int index = GlobalInvoker->addConnection(pConn);
 	if (!pConn->connect(ex, url, host.c_str())) {
 		ERROR("Error in connect : ", ex.error())
@@ -242,7 +248,7 @@ int RTMFP_Read(const char* peerId, unsigned int RTMFPcontext,char *buf,unsigned
 				total += nbRead;
 			}
 			else { // Nothing read, wait for data
-				while (!pConn->dataAvailable) {
+				while (!pConn->dataWaiting(peerId)) {
 					DEBUG("Nothing available, sleeping...")
 					pConn->readSignal.wait(100);
 					if (GlobalInterruptCb(GlobalInterruptArg) == 1)
@@ -256,6 +262,121 @@ int RTMFP_Read(const char* peerId, unsigned int RTMFPcontext,char *buf,unsigned
 	return -1;
 }
 
+int RTMFP_ReadPacket(const char* peerId, unsigned int RTMFPcontext, RTMFPPacket* packet) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return -1;
+	}
+
+	shared_ptr<RTMFPSession> pConn;
+	GlobalInvoker->getConnection(RTMFPcontext, pConn);
+	if (pConn) {
+		const UInt8* tag = NULL;
+		UInt32 size = 0;
+		while (GlobalInterruptCb(GlobalInterruptArg) != 1) {
+			if (!pConn->readPacket(peerId, tag, size)) {
+				WARN("Connection is not established, cannot read data")
+				return -1;
+			}
+			if (tag) {
+				BinaryReader reader(tag, size);
+				packet->tag = (const char*)tag;
+				packet->tagSize = size;
+				packet->audio = reader.read8() == AMF::AUDIO;
+				packet->size = reader.read24();
+				packet->time = reader.read24();
+				packet->time |= reader.read8() << 24; // extended time
+				packet->data = packet->tag + 11;
+				return 1;
+			}
+			// Nothing read, wait for data
+			while (!pConn->dataWaiting(peerId)) {
+				DEBUG("Nothing available, sleeping...")
+				pConn->readSignal.wait(100);
+				if (GlobalInterruptCb(GlobalInterruptArg) == 1)
+					return 0;
+			}
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+void RTMFP_ReleasePacket(unsigned int RTMFPcontext) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return;
+	}
+
+	shared_ptr<RTMFPSession> pConn;
+	GlobalInvoker->getConnection(RTMFPcontext, pConn);
+	if (pConn)
+		pConn->releasePacket();
+}
+
+unsigned long long RTMFP_GetDroppedDuration(unsigned int RTMFPcontext) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return 0;
+	}
+
+	shared_ptr<RTMFPSession> pConn;
+	GlobalInvoker->getConnection(RTMFPcontext, pConn);
+	if (pConn)
+		return pConn->droppedDuration();
+
+	return 0;
+}
+
+int RTMFP_GetReadyFd(unsigned int RTMFPcontext) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return -1;
+	}
+
+	shared_ptr<RTMFPSession> pConn;
+	GlobalInvoker->getConnection(RTMFPcontext, pConn);
+	if (pConn)
+		return pConn->readySignal.fd();
+
+	return -1;
+}
+
+int RTMFP_Poll(const unsigned int* contexts, unsigned int count, int* ready, unsigned int timeout) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return -1;
+	}
+	if (!contexts || !ready || !count)
+		return -1;
+
+	// Keep references to the sessions while waiting
+	vector<shared_ptr<RTMFPSession>> connections(count);
+	vector<PollableSignal*> signals(count);
+	for (UInt32 i = 0; i < count; ++i) {
+		GlobalInvoker->getConnection(contexts[i], connections[i]);
+		if (!connections[i])
+			return -1;
+		signals[i] = &connections[i]->readySignal;
+	}
+
+	// Wait by slices to check the interrupt callback
+	Time start;
+	UInt32 waited = 0;
+	while (!PollableSignal::WaitAny(signals, min<UInt32>(timeout - waited, RTMFP_POLL_INTERRUPT_PERIOD))) {
+		if ((GlobalInterruptCb && GlobalInterruptCb(GlobalInterruptArg) == 1) || (waited = (UInt32)start.elapsed()) >= timeout)
+			return 0;
+	}
+
+	int nbReady = 0;
+	for (UInt32 i = 0; i < count; ++i) {
+		ready[i] = connections[i]->pollReady() ? 1 : 0;
+		nbReady += ready[i];
+	}
+	return nbReady;
+}
+
 int RTMFP_Write(unsigned int RTMFPcontext,const char *buf,int size) {
 	if (!GlobalInvoker) {
 		ERROR("Invoker is not ready, you must establish the connection first")
@@ -268,12 +389,56 @@ int RTMFP_Write(unsigned int RTMFPcontext,const char *buf,int size) {
 		int pos = 0;
 		if (!pConn->write((const UInt8*)buf, size, pos))
 			return -1;
+		if (!pos && pConn->publicationFull())
+			return RTMFP_WOULD_BLOCK;
 		return pos;
 	}
 	
 	return -1;
 }
 
+int RTMFP_WriteFrame(unsigned int RTMFPcontext, int type, unsigned int timestamp, const char* data, unsigned int size, int flags) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return -1;
+	}
+	if (type != RTMFP_FRAME_AUDIO && type != RTMFP_FRAME_VIDEO) {
+		ERROR("Unexpected frame type : ", type)
+		return -1;
+	}
+	if (!data || !size) {
+		ERROR("Frame data must be not null nor empty")
+		return -1;
+	}
+
+	shared_ptr<RTMFPSession> pConn;
+	GlobalInvoker->getConnection(RTMFPcontext, pConn);
+	if (pConn) {
+		bool pushed(false);
+		if (!pConn->writeFrame((AMF::ContentType)type, timestamp, (const UInt8*)data, size, flags & (RTMFP_FRAME_KEY | RTMFP_FRAME_CONFIG), pushed))
+			return -1;
+		if (!pushed && pConn->publicationFull())
+			return RTMFP_WOULD_BLOCK;
+		return pushed ? 1 : 0;
+	}
+
+	return -1;
+}
+
+unsigned int RTMFP_GetPublishQueued(unsigned int RTMFPcontext) {
+	if (!GlobalInvoker) {
+		ERROR("Invoker is not ready, you must establish the connection first")
+		return 0;
+	}
+
+	shared_ptr<RTMFPSession> pConn;
+	GlobalInvoker->getConnection(RTMFPcontext, pConn);
+	if (pConn)
+		return pConn->publicationQueued();
+
+	return 0;
+}
+
 unsigned int RTMFP_CallFunction(unsigned int RTMFPcontext, const char* function, int nbArgs, const char** args, const char* peerId) {
 	if (!GlobalInvoker) {
 		ERROR("Invoker is not ready, you must establish the connection first")